@@ -103,6 +103,16 @@ SearchResult* AsmProfileGen::FindImplementation(const Tree* Exp, std::ostream &L
   Search S(RuleManager, InstructionManager);
   unsigned SearchDepth = INITIAL_DEPTH;
   SearchResult *R = NULL;
+#ifdef BEST_FIRST_SEARCH
+  // Best-first search deepens by itself, up to the deepest level the
+  // increasing depth loop would try
+  while (SearchDepth + SEARCH_STEP < SEARCH_DEPTH)
+    SearchDepth = SearchDepth + SEARCH_STEP;
+  Log << "  Trying best-first search with depth " << SearchDepth << "\n";
+  S.setStrategy(BestFirstStrategy, INITIAL_DEPTH, SEARCH_STEP);
+  S.setMaxDepth(SearchDepth);
+  R = S(Exp, 0, NULL);
+#else
   // Increasing search depth loop - first try with low depth to speed up
   // easy matches
   while (R == NULL || R->Instructions->size() == 0) {
@@ -113,8 +123,13 @@ SearchResult* AsmProfileGen::FindImplementation(const Tree* Exp, std::ostream &L
     SearchDepth = SearchDepth + SEARCH_STEP;
     if (R != NULL)
       delete R;
+    unsigned Cutoffs = S.getCutoffs();
     R = S(Exp, 0, NULL);
+    // A failure the depth limit played no part in is final
+    if (R->Instructions->size() == 0 && S.getCutoffs() == Cutoffs)
+      break;
   }
+#endif
   // Detecting failures
   if (R == NULL) {
     Log << "  Not found!\n";
@@ -156,7 +171,7 @@ void AsmProfileGen::PrintPatternImpl(SearchResult *SR, std::ostream &O) {
     // Virtual registers are identified by "AReg999"
     for (NameListType::iterator I2 = OpNames->begin(), E2 = OpNames->end();
 	 I2 != E2; ++I2) {
-      if (!I2->substr(0,4).compare("AReg")) {
+      if (!I2->str().substr(0,4).compare("AReg")) {
 	*I2 = RA->getPhysRegisterRef(*I2)->getAssemblyName();
 	continue;
       }
@@ -169,7 +184,9 @@ void AsmProfileGen::PrintPatternImpl(SearchResult *SR, std::ostream &O) {
       }
     }
     // Print instruction assembly syntax to ostream
-    I->first->emitAssembly(*OpNames, I->second, O);
+    I->first->emitAssembly(std::list<std::string>(OpNames->begin(),
+						  OpNames->end()),
+			   I->second, O);
     RA->NextInstruction();
     if (I->first->HasDelaySlot()) {
       assert (SR != NopImpl && "Nop implementation should not use delay slots");
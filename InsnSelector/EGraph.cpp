@@ -0,0 +1,324 @@
+//===- EGraph.cpp - Equality saturation of expressions    --*- C++ -*------===//
+//
+//              The ArchC Project - Compiler Backend Generation
+//
+//===----------------------------------------------------------------------===//
+//
+// Equality saturation of expressions. An e-graph holds all forms of an
+// expression that transformation rules may lead to, sharing the parts
+// these forms have in common. The cheapest form, given the instructions
+// available, can then be extracted from it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "EGraph.h"
+#include <set>
+#include <climits>
+#include <cassert>
+
+namespace backendgen {
+
+  using namespace backendgen::expression;
+
+  // Matches of a pattern rooted at a single class are limited to this
+  const unsigned MAX_CLASS_MATCHES = 256;
+
+  // EGraph member functions
+
+  // Rules matching a lone operand would apply to every class, so only
+  // patterns rooted at an operator are matched. Operands a rule names
+  // afresh (see IsDetermined) would never be shared, so such rules are
+  // left out as well.
+  EGraph::EGraph(TransformationRules& RulesMgr, InstrManager& InstructionsMgr):
+    InstructionsMgr(InstructionsMgr) {
+    for (RuleIterator I = RulesMgr.getBegin(), E = RulesMgr.getEnd(); I != E;
+	 ++I) {
+      if (I->Decomposition || I->Composition || !I->OpTransList.empty())
+	continue;
+      std::set<std::string> LHSNames, RHSNames;
+      CollectOperandNames(I->LHS, LHSNames);
+      CollectOperandNames(I->RHS, RHSNames);
+      if (I->LHS->isOperator() && IsDetermined(I->RHS, LHSNames)) {
+	ERule R = {&*I, I->LHS, I->RHS};
+	Rules.push_back(R);
+      }
+      if (I->Equivalence && I->RHS->isOperator() &&
+	  IsDetermined(I->LHS, RHSNames)) {
+	ERule R = {&*I, I->RHS, I->LHS};
+	Rules.push_back(R);
+      }
+    }
+  }
+
+  unsigned EGraph::Find(unsigned Class) {
+    while (Parent[Class] != Class) {
+      Parent[Class] = Parent[Parent[Class]];
+      Class = Parent[Class];
+    }
+    return Class;
+  }
+
+  // Returns false if A and B already were the same class. The class
+  // created first survives.
+  bool EGraph::Union(unsigned A, unsigned B) {
+    A = Find(A);
+    B = Find(B);
+    if (A == B)
+      return false;
+    if (B < A)
+      std::swap(A, B);
+    Parent[B] = A;
+    Members[A].insert(Members[A].end(), Members[B].begin(), Members[B].end());
+    Members[B].clear();
+    return true;
+  }
+
+  // Also brings the children of N up to date
+  EGraph::NodeKey EGraph::getKey(ENode& N) {
+    NodeKey Key;
+    if (!N.Proto->isOperator()) {
+      Key.push_back(0);
+      Key.push_back(Leaves[N.Proto]);
+      return Key;
+    }
+    const Operator* O = static_cast<const Operator*>(N.Proto);
+    Key.push_back(1);
+    Key.push_back(O->getType());
+    Key.push_back(O->getSize());
+    Key.push_back(O->getReturnTypeType());
+    Key.push_back(O->isTransferDestination());
+    for (unsigned I = 0, E = N.Children.size(); I != E; ++I) {
+      N.Children[I] = Find(N.Children[I]);
+      Key.push_back(N.Children[I]);
+    }
+    return Key;
+  }
+
+  unsigned EGraph::AddNode(const Tree* Proto,
+			   const std::vector<unsigned>& Children,
+			   unsigned RuleID) {
+    ENode N;
+    N.Proto = Proto;
+    N.Children = Children;
+    N.Class = Parent.size();
+    N.RuleID = RuleID;
+    const NodeKey Key = getKey(N);
+    std::map<NodeKey, unsigned>::const_iterator I = HashCons.find(Key);
+    if (I != HashCons.end())
+      return Find(Nodes[I->second].Class);
+    HashCons[Key] = Nodes.size();
+    Parent.push_back(N.Class);
+    Members.push_back(std::vector<unsigned>(1, Nodes.size()));
+    Nodes.push_back(N);
+    return N.Class;
+  }
+
+  unsigned EGraph::AddExpression(const Tree* Expression) {
+    if (!Expression->isOperator()) {
+      // Leafs are told apart by their shared version
+      const Tree* Leaf = NodeFactory::Instance().intern(Expression);
+      Leaves.insert(std::make_pair(Leaf, Leaves.size()));
+      return AddNode(Leaf, std::vector<unsigned>(), 0);
+    }
+    const Operator* O = static_cast<const Operator*>(Expression);
+    std::vector<unsigned> Children;
+    for (int I = 0, E = O->getArity(); I != E; ++I)
+      Children.push_back(AddExpression((*O)[I]));
+    return AddNode(Expression, Children, 0);
+  }
+
+  // Pattern operands are either bound by B or constants (see IsDetermined)
+  unsigned EGraph::AddPattern(const Tree* Pattern, const Bindings& B,
+			      unsigned RuleID) {
+    if (Pattern->isOperand()) {
+      const std::string& Name =
+	static_cast<const Operand*>(Pattern)->getOperandName();
+      for (Bindings::const_iterator I = B.begin(), E = B.end(); I != E; ++I)
+	if (I->first == Name)
+	  return I->second;
+      assert (Pattern->getKind() == ConstantNode && "Unbound rule operand");
+      return AddExpression(Pattern);
+    }
+    const Operator* O = static_cast<const Operator*>(Pattern);
+    std::vector<unsigned> Children;
+    for (int I = 0, E = O->getArity(); I != E; ++I)
+      Children.push_back(AddPattern((*O)[I], B, 0));
+    return AddNode(Pattern, Children, RuleID);
+  }
+
+  // Restores the invariants broken by unions: nodes that became equal
+  // belong to the same class and each class lists its distinct nodes.
+  // Returns true if this merged classes.
+  bool EGraph::Rebuild() {
+    bool Merged = false, Changed = true;
+    while (Changed) {
+      Changed = false;
+      HashCons.clear();
+      for (unsigned I = 0, E = Nodes.size(); I != E; ++I) {
+	std::pair<std::map<NodeKey, unsigned>::iterator, bool> Pos =
+	  HashCons.insert(std::make_pair(getKey(Nodes[I]), I));
+	if (!Pos.second && Union(Nodes[Pos.first->second].Class,
+				 Nodes[I].Class))
+	  Changed = Merged = true;
+      }
+    }
+    for (unsigned I = 0, E = Members.size(); I != E; ++I)
+      Members[I].clear();
+    for (std::map<NodeKey, unsigned>::const_iterator I = HashCons.begin(),
+	   E = HashCons.end(); I != E; ++I)
+      Members[Find(Nodes[I->second].Class)].push_back(I->second);
+    return Merged;
+  }
+
+  // Replaces each binding set in Matches by its extensions with the ways
+  // Pattern matches Class. Nodes the rule is applied to (Root) may not be
+  // transfer destinations.
+  void EGraph::MatchPattern(const Tree* Pattern, unsigned Class,
+			    std::vector<Bindings>& Matches, bool Root) {
+    Class = Find(Class);
+    std::vector<Bindings> Result;
+    const std::vector<unsigned>& Candidates = Members[Class];
+    if (Pattern->isOperand()) {
+      const std::string& Name =
+	static_cast<const Operand*>(Pattern)->getOperandName();
+      bool Matched = false;
+      for (unsigned I = 0, E = Candidates.size(); I != E && !Matched; ++I)
+	Matched = MatchRuleNode(Pattern, Nodes[Candidates[I]].Proto);
+      for (unsigned I = 0, E = Matches.size(); I != E; ++I) {
+	Bindings::const_iterator Pos = Matches[I].begin(),
+	  End = Matches[I].end();
+	while (Pos != End && Pos->first != Name)
+	  ++Pos;
+	// An operand appearing twice must match the same class
+	if (Pos != End) {
+	  if (Pos->second == Class)
+	    Result.push_back(Matches[I]);
+	} else if (Matched) {
+	  Result.push_back(Matches[I]);
+	  Result.back().push_back(std::make_pair(Name, Class));
+	}
+      }
+      Matches.swap(Result);
+      return;
+    }
+    const Operator* P = static_cast<const Operator*>(Pattern);
+    for (unsigned I = 0, E = Candidates.size(); I != E; ++I) {
+      const ENode& N = Nodes[Candidates[I]];
+      if (!MatchRuleNode(Pattern, N.Proto) ||
+	  (Root && N.Proto->isTransferDestination()))
+	continue;
+      std::vector<Bindings> Partial(Matches);
+      for (int Child = 0, Arity = P->getArity();
+	   Child != Arity && !Partial.empty(); ++Child)
+	MatchPattern((*P)[Child], N.Children[Child], Partial, false);
+      Result.insert(Result.end(), Partial.begin(), Partial.end());
+      if (Result.size() >= MAX_CLASS_MATCHES)
+	break;
+    }
+    Matches.swap(Result);
+  }
+
+  // Each round applies rules to the forms found by the previous rounds, as
+  // a search one level deeper would
+  void EGraph::Saturate(unsigned MaxNodes, unsigned MaxRounds) {
+    bool Changed = true;
+    for (unsigned Round = 0; Changed && Round != MaxRounds &&
+	   size() < MaxNodes; ++Round) {
+      Changed = false;
+      // All matches are found before the e-graph changes
+      std::vector<std::pair<const ERule*, unsigned> > Targets;
+      std::vector<Bindings> Found;
+      for (unsigned Class = 0, E = Members.size(); Class != E; ++Class) {
+	if (Members[Class].empty())
+	  continue;
+	for (std::vector<ERule>::const_iterator I = Rules.begin(),
+	       IE = Rules.end(); I != IE; ++I) {
+	  std::vector<Bindings> Matches(1);
+	  MatchPattern(I->From, Class, Matches, true);
+	  for (unsigned M = 0, ME = Matches.size(); M != ME; ++M) {
+	    Targets.push_back(std::make_pair(&*I, Class));
+	    Found.push_back(Matches[M]);
+	  }
+	}
+      }
+      for (unsigned I = 0, E = Found.size(); I != E && size() < MaxNodes;
+	   ++I) {
+	const unsigned Class =
+	  AddPattern(Targets[I].first->To, Found[I], Targets[I].first->R->RuleID);
+	if (Union(Targets[I].second, Class))
+	  Changed = true;
+      }
+      if (Rebuild())
+	Changed = true;
+    }
+  }
+
+  // Cost of N alone: the cheapest instruction having its operator as
+  // primary operator
+  CostType EGraph::getNodeCost(const ENode& N) {
+    if (!N.Proto->isOperator() || N.Proto->getType() == AssignOp)
+      return 0;
+    const CandidateList& Candidates =
+      InstructionsMgr.getCandidates(std::make_pair(N.Proto->getType(), 0U));
+    CostType Min = EGRAPH_UNKNOWN_COST;
+    for (CandidateList::const_iterator I = Candidates.begin(),
+	   E = Candidates.end(); I != E; ++I)
+      if (I->Insn->getCost() < Min)
+	Min = I->Insn->getCost();
+    return Min;
+  }
+
+  Tree* EGraph::Materialize(unsigned Class, RulesAppliedList& Applied) {
+    const ENode& N = Nodes[Best[Class]];
+    if (N.RuleID != 0)
+      Applied.push_back(N.RuleID);
+    // Leafs are shared
+    if (!N.Proto->isOperator())
+      return const_cast<Tree*>(N.Proto);
+    Operator* O = new Operator(*static_cast<const Operator*>(N.Proto));
+    for (unsigned I = 0, E = N.Children.size(); I != E; ++I) {
+      Tree* Child = Materialize(Find(N.Children[I]), Applied);
+      // A transfer destination must carry its flag
+      if (I == 0 && O->isAssignOp() && Child->isShared() &&
+	  !Child->isTransferDestination())
+	Child = Child->clone();
+      O->setChild(I, Child);
+    }
+    return O;
+  }
+
+  // Costs are found by relaxing them until no class gets cheaper. A node
+  // only becomes the best of its class if it is strictly cheaper, so the
+  // best nodes never form a cycle.
+  Tree* EGraph::Extract(unsigned Class, RulesAppliedList& Applied) {
+    std::vector<CostType> NodeCost(Nodes.size(), INT_MAX);
+    for (std::map<NodeKey, unsigned>::const_iterator I = HashCons.begin(),
+	   E = HashCons.end(); I != E; ++I)
+      NodeCost[I->second] = getNodeCost(Nodes[I->second]);
+    Best.assign(Members.size(), 0);
+    Cost.assign(Members.size(), INT_MAX);
+    bool Changed = true;
+    while (Changed) {
+      Changed = false;
+      for (unsigned C = 0, E = Members.size(); C != E; ++C) {
+	for (unsigned I = 0, IE = Members[C].size(); I != IE; ++I) {
+	  const ENode& N = Nodes[Members[C][I]];
+	  CostType Total = NodeCost[Members[C][I]];
+	  for (unsigned Child = 0, CE = N.Children.size();
+	       Child != CE && Total < INT_MAX; ++Child) {
+	    const CostType ChildCost = Cost[Find(N.Children[Child])];
+	    Total = ChildCost >= INT_MAX - Total? INT_MAX : Total + ChildCost;
+	  }
+	  if (Total < Cost[C]) {
+	    Cost[C] = Total;
+	    Best[C] = Members[C][I];
+	    Changed = true;
+	  }
+	}
+      }
+    }
+    assert (Cost[Find(Class)] != INT_MAX && "Class has no finite form");
+    return Materialize(Find(Class), Applied);
+  }
+
+}
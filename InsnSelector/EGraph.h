@@ -0,0 +1,98 @@
+//===- EGraph.h - Header file                             --*- C++ -*------===//
+//
+//              The ArchC Project - Compiler Backend Generation
+//
+//===----------------------------------------------------------------------===//
+//
+// Equality saturation of expressions. An e-graph holds all forms of an
+// expression that transformation rules may lead to, sharing the parts
+// these forms have in common. The cheapest form, given the instructions
+// available, can then be extracted from it.
+//
+//===----------------------------------------------------------------------===//
+#ifndef EGRAPH_H
+#define EGRAPH_H
+
+#include "Search.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace backendgen {
+
+  // Limits of saturation (see EGraph::Saturate): nodes an e-graph may
+  // grow to and rounds of rule applications. Rules may always build a
+  // larger tree, e.g. by negating twice, so saturation seldom ends by
+  // itself.
+  const unsigned EGRAPH_NODES = 4000;
+  const unsigned EGRAPH_ROUNDS = 12;
+  // Cost assumed for an operator no instruction has as primary operator
+  const CostType EGRAPH_UNKNOWN_COST = 1000;
+
+  // Classes of equivalent expressions (e-classes) built from nodes whose
+  // children are classes (e-nodes). Only rules that rewrite an operator
+  // into a tree fully determined by the match are used: decompositions
+  // and rules with operand transformations need the search engine.
+  class EGraph {
+    struct ENode {
+      // Operator or leaf this node stands for. Children of an operator
+      // are given by Children, not by the operator itself.
+      const expression::Tree* Proto;
+      std::vector<unsigned> Children;
+      unsigned Class;
+      // Rule that created this node, 0 if it comes from the expression
+      unsigned RuleID;
+    };
+    // A rule, in one direction, the e-graph may use
+    struct ERule {
+      const Rule* R;
+      const expression::Tree *From, *To;
+    };
+    typedef std::vector<unsigned> NodeKey;
+    typedef std::vector<std::pair<std::string, unsigned> > Bindings;
+
+    InstrManager& InstructionsMgr;
+    std::vector<ERule> Rules;
+    std::vector<ENode> Nodes;
+    // Union-find over classes
+    std::vector<unsigned> Parent;
+    // Distinct nodes of each class, for classes that are their own parent
+    std::vector<std::vector<unsigned> > Members;
+    std::map<NodeKey, unsigned> HashCons;
+    // Index of each shared leaf, as used in node keys
+    std::map<const expression::Tree*, unsigned> Leaves;
+    // Cheapest node of each class and its cost (see Extract)
+    std::vector<unsigned> Best;
+    std::vector<CostType> Cost;
+
+    unsigned Find(unsigned Class);
+    bool Union(unsigned A, unsigned B);
+    NodeKey getKey(ENode& N);
+    unsigned AddNode(const expression::Tree* Proto,
+		     const std::vector<unsigned>& Children, unsigned RuleID);
+    unsigned AddPattern(const expression::Tree* Pattern, const Bindings& B,
+			unsigned RuleID);
+    bool Rebuild();
+    void MatchPattern(const expression::Tree* Pattern, unsigned Class,
+		      std::vector<Bindings>& Matches, bool Root);
+    CostType getNodeCost(const ENode& N);
+    expression::Tree* Materialize(unsigned Class, RulesAppliedList& Applied);
+  public:
+    EGraph(TransformationRules& RulesMgr, InstrManager& InstructionsMgr);
+    // Adds Expression, returning its class. Expression must outlive this
+    // e-graph.
+    unsigned AddExpression(const expression::Tree* Expression);
+    // Applies rules to all classes until nothing new is found, the
+    // e-graph has MaxNodes nodes or MaxRounds rounds were made
+    void Saturate(unsigned MaxNodes, unsigned MaxRounds);
+    // Builds the cheapest expression of Class, an unshared tree. Applied
+    // receives the rules that created its nodes, in preorder of the nodes.
+    // This is not an order the rules may be applied in: a node may have
+    // been created from a form that is not part of the result.
+    expression::Tree* Extract(unsigned Class, RulesAppliedList& Applied);
+    unsigned size() const { return HashCons.size(); }
+  };
+
+}
+
+#endif
@@ -10,13 +10,30 @@
 //===----------------------------------------------------------------------===//
 
 #include "Search.h"  
+#include "EGraph.h"
 #include "../Support.h"
 #include <climits>
 #include <cassert>
+#include <fstream>
+#include <cctype>
+#include <algorithm>
+#include <queue>
+#include <set>
 
 //#define DEBUG
 #define DEBUG_SEARCH_RESULTS
 #define USETRANSCACHE
+#define USESEARCHMEMO
+// Number of rule applications considered by the CloseSemantic heuristic
+// when deciding if an expression may become an instruction semantic.
+// Larger values prune less.
+#define REACHABILITY_STEPS 1
+// In parallel search, independent children of nodes above this depth are
+// solved concurrently (see SolveSubgoals)
+#define AND_PARALLEL_DEPTH 2
+// Expanded nodes between two readings of the clock, when the search has a
+// time budget
+#define CLOCK_CHECK_INTERVAL 256
 //#define EXTENSIVESEARCH
 
 namespace backendgen {
@@ -39,9 +56,8 @@ namespace backendgen {
 #endif
 
   //Static member definition
-#ifdef STATIC_TRANSCACHE      
   TransformationCache Search::TransCache;
-#endif
+  SearchMemo Search::Memo;
 
   // Auxiliaries EqualTypes and EqualNodeTypes are used in the
   // prune heuristic to compare node types
@@ -68,6 +84,9 @@ namespace backendgen {
   // that two trees are identical
   bool CacheExactCompare(const Tree*E1, const Tree *E2) {
     bool isOperator;
+    // Shared subtrees are hash-consed: same pointer, same tree
+    if (E1 == E2)
+      return true;
     // Notes: We match if E2 implements the same operation with
     // greater data size - this means we imply that E1 is the
     // wanted expression and E2 is the implementation proposal
@@ -77,42 +96,32 @@ namespace backendgen {
     {
       //Leaf
       if (!isOperator) {
+	const NodeKind K1 = E1->getKind(), K2 = E2->getKind();
 	// Constant
-	const Constant* C1 = dynamic_cast<const Constant*>(E1);
-	const Constant* C2 = dynamic_cast<const Constant*>(E2);
-	if ((C1 == NULL && C2 != NULL) || (C1 != NULL && C2 == NULL))
+	if ((K1 == ConstantNode) != (K2 == ConstantNode))
 	  return false;
-	if (C1 != NULL) {	    	    	    
-	   if (C1->getConstValue() != C2->getConstValue())
-	     return false;
-	   else
-	     return true;
-	}
+	if (K1 == ConstantNode)
+	  return static_cast<const Constant*>(E1)->getConstValue() ==
+	    static_cast<const Constant*>(E2)->getConstValue();
 	// Immediate 
-	const ImmediateOperand* I1 = 
-	  dynamic_cast<const ImmediateOperand*>(E1);
-	const ImmediateOperand* I2 = 
-	  dynamic_cast<const ImmediateOperand*>(E2);
-	if ((I1 == NULL && I2 != NULL) || (I1 != NULL && I2 == NULL)) 
+	if ((K1 == ImmediateNode) != (K2 == ImmediateNode))
 	  return false;  
-	if (I1 != NULL)
+	if (K1 == ImmediateNode)
 	  return true;
 	// Register
-	const Operand * O1 = dynamic_cast<const Operand*>(E1),
-	    * O2 = dynamic_cast<const Operand*>(E2);
-	if ((O1 == NULL && O2 != NULL) || (O1 != NULL && O2 == NULL)) 
-	  return false;  
+	const Operand * O1 = static_cast<const Operand*>(E1),
+	    * O2 = static_cast<const Operand*>(E2);
 	// If both are specific references, they must match ref. names
 	if (O1->isSpecificReference() && 
-	    O1->getOperandName() != O2->getOperandName()) 
+	    O1->getOperandSymbol() != O2->getOperandSymbol()) 
 	  return false;	 	
 	return true;
       }
       // Operator
       bool match = true;	
       // and analyze its children
-      const Operator *O1 = dynamic_cast<const Operator*>(E1),
-	*O2 = dynamic_cast<const Operator*>(E2);
+      const Operator *O1 = static_cast<const Operator*>(E1),
+	*O2 = static_cast<const Operator*>(E2);
       for (int I = 0, E = O1->getArity(); I != E; ++I) {
 	if (!CacheExactCompare((*O1)[I], (*O2)[I])) {
 	  match = false;
@@ -140,92 +149,78 @@ namespace backendgen {
     // wanted expression and E2 is the implementation proposal
     if ((isOperator = E1->isOperator()) == E2->isOperator() &&
 	((isOperator && (E1->getType() == E2->getType())) ||
-	 (!isOperator && dynamic_cast<const Operand*>(E1)->getDataType() ==
-	                 dynamic_cast<const Operand*>(E2)->getDataType())) &&
+	 (!isOperator && static_cast<const Operand*>(E1)->getDataType() ==
+	                 static_cast<const Operand*>(E2)->getDataType())) &&
 	E1->getSize() <= E2->getSize())
       {
 	// Leaf?
 	if (!isOperator) {
-	  const Constant* C1 = dynamic_cast<const Constant*>(E1);
-	  const Constant* C2 = dynamic_cast<const Constant*>(E2);
-	  if ((C1 == NULL && C2 != NULL) || (C1 != NULL && C2 == NULL && 
-	    dynamic_cast<const ImmediateOperand*>(E2) == NULL)) 
+	  const NodeKind K1 = E1->getKind(), K2 = E2->getKind();
+	  const Operand * O1 = static_cast<const Operand*>(E1),
+	    * O2 = static_cast<const Operand*>(E2);
+	  if ((K1 != ConstantNode && K2 == ConstantNode) ||
+	      (K1 == ConstantNode && K2 != ConstantNode &&
+	       K2 != ImmediateNode))
 	    return false;
-	  if (C1 != NULL && dynamic_cast<const ImmediateOperand*>(E2) != NULL)
+	  if (K1 == ConstantNode && K2 == ImmediateNode)
 	    {
 	    if (ST != NULL) {
 	      std::stringstream S;
-	      S << C1->getConstValue();
-	      return ST->AddToVRList(std::make_pair(C1->getOperandName(),
-		S.str()));
+	      S << static_cast<const Constant*>(E1)->getConstValue();
+	      return ST->AddToVRList(RegPair(O1->getOperandSymbol(), S.str()));
 	    } else {
 	      return false;
 	    }
 	  }
 	  // Depending on the operand type, we need to make further checkings
 	  // Constants must be equal
-	  if (C1 != NULL && C2 != NULL) {	    	    	    
-	    if (C1->getConstValue() != C2->getConstValue())
+	  if (K1 == ConstantNode && K2 == ConstantNode) {
+	    if (static_cast<const Constant*>(E1)->getConstValue() !=
+		static_cast<const Constant*>(E2)->getConstValue())
 	      return false;
 	  }
 
 	  // RegisterOperand handling
-	  const RegisterOperand* RO1 = 
-	    dynamic_cast<const RegisterOperand*>(E1);
-	  const RegisterOperand* RO2 =
-	    dynamic_cast<const RegisterOperand*>(E2);
-	  if (RO1 != NULL && RO2 != NULL) {
-	    if (RO1->getRegisterClass() != RO2->getRegisterClass())
+	  const RegisterOperand* RO2 = (K2 == RegisterNode)?
+	    static_cast<const RegisterOperand*>(E2) : NULL;
+	  if (K1 == RegisterNode && RO2 != NULL) {
+	    if (static_cast<const RegisterOperand*>(E1)->getRegisterClass() !=
+		RO2->getRegisterClass())
 	      return false;
 	  }
 	  // if semantic (RO2) is a register, check for specific registers
 	  // being used and check if their reg. classes match
 	  if (RO2 != NULL) {
-	    const std::string *Name = 0;
+	    const Symbol *Name = 0;
 	    if (ST != NULL) {
-	      if (ST->LookupVR(dynamic_cast<const Operand*>(E1)
-			       ->getOperandName(),
-			       Name)) {
+	      if (ST->LookupVR(O1->getOperandSymbol(), Name)) {
 		if (!RO2->getRegisterClass()->hasRegisterName(*Name))
 		  return false;
 	      }	      
 	      const RegisterClass *rclass = 0;
-	      if (ST->LookupVC(dynamic_cast<const Operand*>(E1)
-			       ->getOperandName(),
-			       rclass)) {
+	      if (ST->LookupVC(O1->getOperandSymbol(), rclass)) {
 		if (!(RO2->getRegisterClass() != rclass))
 		  return false;
 	      }	else {
-		ST->AddToVCList(std::make_pair(dynamic_cast<
-					       const Operand*>(E1)
-					       ->getOperandName(),
-					       RO2->
-					       getRegisterClass()));
+		ST->AddToVCList(VCPair(O1->getOperandSymbol(),
+				       RO2->getRegisterClass()));
 	      }
 	    }
 	  }	  
 
 	  // Immediate handling
-	  const ImmediateOperand* I1 = 
-	    dynamic_cast<const ImmediateOperand*>(E1);
-	  const ImmediateOperand* I2 = 
-	    dynamic_cast<const ImmediateOperand*>(E2);
-	  if ((I1 == NULL && I2 != NULL) || (I1 != NULL && I2 == NULL)) 
+	  if ((K1 == ImmediateNode) != (K2 == ImmediateNode))
 	    return false;  
 	  
 	  // References to specific registers must be equal
-	  const Operand * O1 = dynamic_cast<const Operand*>(E1),
-	    * O2 = dynamic_cast<const Operand*>(E2);
-	  assert (O1 != NULL && O2 != NULL && "Nodes must be operands");
-	  
 	  if (O2->isSpecificReference() && !O1->isSpecificReference()) {
 	    if (!O1->acceptsSpecificReference())
 	      return false;
 	    // It will return true only if the virtual register (specified
 	    // by E1) is not already mapped to a different real reg.
 	    if (ST != NULL) {
-	      return ST->AddToVRList(std::make_pair(O1->getOperandName(),
-						    O2->getOperandName()));
+	      return ST->AddToVRList(RegPair(O1->getOperandSymbol(),
+					     O2->getOperandSymbol()));
 	    } else {
 	      return false;
 	    }
@@ -233,7 +228,7 @@ namespace backendgen {
 	  }
 	  // If both are specific references, they must match ref. names
 	  if (O2->isSpecificReference() && O1->isSpecificReference() && 
-	      O1->getOperandName() != O2->getOperandName()) 
+	      O1->getOperandSymbol() != O2->getOperandSymbol()) 
 	    return false;	      
 	  
 	  return true;
@@ -245,8 +240,8 @@ namespace backendgen {
 	// Now we know we are handling with operators	
 	bool match = true;	
 	// and analyze its children
-	const Operator *O1 = dynamic_cast<const Operator*>(E1),
-	  *O2 = dynamic_cast<const Operator*>(E2);
+	const Operator *O1 = static_cast<const Operator*>(E1),
+	  *O2 = static_cast<const Operator*>(E2);
 	for (int I = 0, E = O1->getArity(); I != E; ++I) {
 	  if (!Compare<false>((*O1)[I], (*O2)[I], ST)) {
 	    match = false;
@@ -261,39 +256,34 @@ namespace backendgen {
   // IsInVRFunctor member functions
 
   bool IsInVRFunctor::operator() (const Tree* A) {
-    const Operand* O = dynamic_cast<const Operand*>(A);
-    if (O != NULL) {
-      for (VirtualToRealMap::const_iterator I = VR->begin(), E = VR->end();
-	   I != E; ++I) {
-	if (O->getOperandName() == I->first)
-	  return false;	 
-      }
-    }
+    if (A->isOperand() &&
+	VR->find(static_cast<const Operand*>(A)->getOperandSymbol())
+	!= VR->end())
+      return false;
     return true;
   } 
   
   // SearchResult member functions
 
-  SearchResult::SearchResult() {
-    Instructions = new InstrList();
-    Cost = INT_MAX;
-    OperandsDefs = new OperandsDefsType();
-    RulesApplied = new RulesAppliedList();
-    ST = new SearchRestrictions();
-    OpTrans = new OpTransLists();
-  }
+  SearchResult::SearchResult() :
+    Instructions(&InstructionsData), Cost(INT_MAX),
+    OperandsDefs(&OperandsDefsData), RulesApplied(&RulesAppliedData),
+    OpTrans(&OpTransData), ST(&STData) { }
 
   SearchResult::~SearchResult() {
-    delete Instructions;
     for (OperandsDefsType::iterator I = OperandsDefs->begin(),
 	   E = OperandsDefs->end(); I != E; ++I)
       {
 	delete *I;
       }
-    delete OperandsDefs;
-    delete RulesApplied;
-    delete ST;
-    delete OpTrans;
+  }
+
+  void* SearchResult::operator new(size_t Size) {
+    return RecyclingPool<SearchResult>::allocate(Size);
+  }
+
+  void SearchResult::operator delete(void* P) {
+    RecyclingPool<SearchResult>::release(P);
   }
 
   // Removes names from OperandsDefs list that are already assigned
@@ -328,14 +318,9 @@ namespace backendgen {
   }
 
   VirtualToRealMap::const_iterator 
-  SearchResult::VRLookupName(std::string S) const {
-    VirtualToRealMap* VR = this->ST->getVR();
-    for (VirtualToRealMap::const_iterator I = VR->begin(), E = VR->end();
-	 I != E; ++I) {
-      if (I->first == S)
-	return I;
-    }
-    return VR->end();
+  SearchResult::VRLookupName(const Symbol& S) const {
+    const VirtualToRealMap* VR = this->ST->getVR();
+    return VR->find(S);
   } 
 
   void SearchResult::DumpResults(std::ostream& S) const {
@@ -373,97 +358,699 @@ namespace backendgen {
   }
 
 
+  // Fingerprint of a tree consistent with CacheExactCompare: it only
+  // covers what CacheExactCompare requires to be equal (node kinds, types
+  // and constant values), and leaves out operand names and sizes.
+  unsigned long long CacheFingerprint(const Tree* E,
+				      unsigned long long Hash) {
+    Hash = Mix64(Hash, E->getType());
+    switch (E->getKind()) {
+    case ConstantNode:
+      return Mix64(Mix64(Hash, 1),
+		   static_cast<const Constant*>(E)->getConstValue());
+    case ImmediateNode:
+      return Mix64(Hash, 2);
+    case OperatorNode:
+      break;
+    default:
+      return Mix64(Hash, 3);
+    }
+    const Operator* O = static_cast<const Operator*>(E);
+    Hash = Mix64(Hash, 4);
+    for (int I = 0, E = O->getArity(); I != E; ++I)
+      Hash = CacheFingerprint((*O)[I], Hash);
+    return Hash;
+  }
+
+  // Stricter fingerprint: trees with the same exact fingerprint always
+  // satisfy CacheExactCompare. It covers sizes and the names of specific
+  // references as well, but no pointers, so it is stable across runs.
+  unsigned long long CacheExactFingerprint(const Tree* E,
+					   unsigned long long Hash) {
+    Hash = Mix64(Mix64(Hash, E->getType()), E->getSize());
+    switch (E->getKind()) {
+    case ConstantNode:
+      return Mix64(Mix64(Hash, 1),
+		   static_cast<const Constant*>(E)->getConstValue());
+    case ImmediateNode:
+      return Mix64(Hash, 2);
+    case OperatorNode:
+      break;
+    default:
+      if (static_cast<const Operand*>(E)->isSpecificReference())
+	return Mix64(Mix64(Hash, 5),
+		     static_cast<const Operand*>(E)->getOperandName());
+      return Mix64(Hash, 3);
+    }
+    const Operator* O = static_cast<const Operator*>(E);
+    Hash = Mix64(Hash, 4);
+    for (int I = 0, E = O->getArity(); I != E; ++I)
+      Hash = CacheExactFingerprint((*O)[I], Hash);
+    return Hash;
+  }
+
   // TransformationCache member functions
-  // prime cache sizes: 1009 10007 103997
-  // power-of-2 sizes: 1024 16384 131072 1048576
-  TransformationCache::TransformationCache() : HASHSIZE(256) {
-    HashTable = new CacheEntry* [HASHSIZE];
-    assert (HashTable != NULL && "MemAlloc fail");
-    for (unsigned I = 0, E = HASHSIZE; I != E; ++I) {
-      HashTable[I] = NULL;
+  // Shard capacity is always a power of 2, grown when 3/4 full.
+  TransformationCache::TransformationCache() {
+    for (unsigned I = 0; I != NUMSHARDS; ++I) {
+      Shard &S = Shards[I];
+      S.Capacity = 64;
+      S.NumEntries = 0;
+      S.HashTable = new CacheEntry [S.Capacity];
+      assert (S.HashTable != NULL && "MemAlloc fail");
+      for (unsigned J = 0, E = S.Capacity; J != E; ++J) {
+	S.HashTable[J].Used = false;
+      }
+#ifdef PARALLEL_SEARCH
+      omp_init_lock(&S.Lock);
+#endif
     }
   }
-  
+
   TransformationCache::~TransformationCache() {
     unsigned size = 0;
-    for (unsigned I = 0, E = HASHSIZE; I != E; ++I) {
-      CacheEntry *p = HashTable[I];
-      while (p) {
-        CacheEntry *next = p->next;
-        size++;
-        delete p->LHS;
-        delete p->RHS;
-        delete p;
-        p = next;
-      }
+    for (unsigned I = 0; I != NUMSHARDS; ++I) {
+      size += Shards[I].NumEntries;
+      delete [] Shards[I].HashTable;
+#ifdef PARALLEL_SEARCH
+      omp_destroy_lock(&Shards[I].Lock);
+#endif
     }
     std::cout << "Transcache size was: " << size << std::endl;
-    delete [] HashTable;
+  }
+
+  // Tables keep their capacity
+  void TransformationCache::Clear() {
+    for (unsigned I = 0; I != NUMSHARDS; ++I) {
+      Shard &S = Shards[I];
+      for (unsigned J = 0, E = S.Capacity; J != E; ++J)
+	S.HashTable[J].Used = false;
+      S.NumEntries = 0;
+    }
+  }
+
+  unsigned long long TransformationCache::Fingerprint(const Tree* Exp,
+						      const Tree* Target) {
+    return CacheFingerprint(Exp, CacheFingerprint(Target, FingerprintBasis));
+  }
+
+  unsigned long long TransformationCache::ExactFingerprint(const Tree* Exp,
+							   const Tree* Target)
+  {
+    return CacheExactFingerprint(Exp, CacheExactFingerprint(Target,
+							    FingerprintBasis));
+  }
+
+  // Must be called with the shard locked
+  void TransformationCache::Grow(Shard &S) {
+    CacheEntry* OldTable = S.HashTable;
+    unsigned OldCapacity = S.Capacity;
+    S.Capacity *= 2;
+    S.HashTable = new CacheEntry [S.Capacity];
+    assert (S.HashTable != NULL && "MemAlloc fail");
+    for (unsigned I = 0, E = S.Capacity; I != E; ++I) {
+      S.HashTable[I].Used = false;
+    }
+    for (unsigned I = 0; I != OldCapacity; ++I) {
+      if (!OldTable[I].Used)
+	continue;
+      unsigned Pos = OldTable[I].Fingerprint & (S.Capacity - 1);
+      while (S.HashTable[Pos].Used)
+	Pos = (Pos + 1) & (S.Capacity - 1);
+      S.HashTable[Pos] = OldTable[I];
+    }
+    delete [] OldTable;
+  }
+
+  void TransformationCache::Insert(unsigned long long Hash,
+				   unsigned long long ExactHash,
+				   const Tree* LHS, const Tree* RHS,
+				   unsigned Depth, CostType Budget) {
+    Shard &S = getShard(Hash);
+#ifdef PARALLEL_SEARCH
+    omp_set_lock(&S.Lock);
+#endif
+    if ((S.NumEntries + 1) * 4 > S.Capacity * 3)
+      Grow(S);
+    unsigned Pos = Hash & (S.Capacity - 1);
+    while (S.HashTable[Pos].Used) {
+      CacheEntry &Entry = S.HashTable[Pos];
+      // Same pair already known to fail: keep the proof that holds for
+      // more searches. Proofs that do not include one another are both kept.
+      if (Entry.ExactFingerprint == ExactHash && Entry.LHS == LHS &&
+	  Entry.RHS == RHS) {
+	if (Entry.Depth >= Depth && Entry.Budget >= Budget)
+	  break;
+	if (Entry.Depth <= Depth && Entry.Budget <= Budget) {
+	  Entry.Depth = Depth;
+	  Entry.Budget = Budget;
+	  break;
+	}
+      }
+      Pos = (Pos + 1) & (S.Capacity - 1);
+    }
+    if (!S.HashTable[Pos].Used) {
+      CacheEntry &Entry = S.HashTable[Pos];
+      Entry.Fingerprint = Hash;
+      Entry.ExactFingerprint = ExactHash;
+      Entry.LHS = LHS;
+      Entry.RHS = RHS;
+      Entry.Depth = Depth;
+      Entry.Budget = Budget;
+      Entry.Used = true;
+      ++S.NumEntries;
+    }
+#ifdef PARALLEL_SEARCH
+    omp_unset_lock(&S.Lock);
+#endif
   }
 
   inline void TransformationCache::Add(const Tree* Exp, const Tree* Target,
-				       unsigned Depth) {
-    unsigned Hash = Exp->getHash(Target->getHash()) % HASHSIZE;
-    CacheEntry * const NewEntry = new CacheEntry();
-    CacheEntry * const Cur = HashTable[Hash];
-    NewEntry->LHS = Exp->clone();
-    NewEntry->RHS = Target->clone();
-    NewEntry->Depth = Depth;
-    NewEntry->next = Cur;
-    HashTable[Hash] = NewEntry;
-    return;
+				       unsigned Depth, CostType Budget) {
+    // Dead ends are stored as shared trees. Instruction semantics and
+    // subexpressions recur across entries and are kept only once.
+    Insert(Fingerprint(Exp, Target), ExactFingerprint(Exp, Target),
+	   NodeFactory::Instance().intern(Exp),
+	   NodeFactory::Instance().intern(Target), Depth, Budget);
+  }
+
+  // Bounded tells whether the dead end found holds only up to some depth
+  inline bool TransformationCache::LookUp(const Tree* Exp, const Tree* Target,
+					  unsigned Depth, CostType Budget,
+					  bool& Bounded, bool& Budgeted) {
+    const unsigned long long Hash = Fingerprint(Exp, Target);
+    unsigned long long ExactHash = 0;
+    bool HasExactHash = false;
+    Shard &S = getShard(Hash);
+    bool Found = false;
+#ifdef PARALLEL_SEARCH
+    omp_set_lock(&S.Lock);
+#endif
+    for (unsigned Pos = Hash & (S.Capacity - 1); S.HashTable[Pos].Used;
+	 Pos = (Pos + 1) & (S.Capacity - 1)) {
+      const CacheEntry* p = &S.HashTable[Pos];
+      if (p->Fingerprint != Hash || Depth > p->Depth || Budget > p->Budget)
+	continue;
+      // Entry loaded from file
+      if (p->LHS == NULL) {
+	if (!HasExactHash) {
+	  ExactHash = ExactFingerprint(Exp, Target);
+	  HasExactHash = true;
+	}
+	if (p->ExactFingerprint == ExactHash) {
+	  Found = true;
+	  Bounded = p->Depth != UNBOUNDED_DEPTH;
+	  Budgeted = p->Budget != INT_MAX;
+	  break;
+	}
+	continue;
+      }
+      if (CacheExactCompare(Target, p->RHS) &&
+          CacheExactCompare(p->LHS, Exp)) {
+	Found = true;
+	Bounded = p->Depth != UNBOUNDED_DEPTH;
+	Budgeted = p->Budget != INT_MAX;
+	break;
+      }
+    }
+#ifdef PARALLEL_SEARCH
+    omp_unset_lock(&S.Lock);
+#endif
+    return Found;
+  }
+
+  // Writes all dead ends to FileName, one per line, after a header with
+  // the version of the machine description and rules they were proved
+  // with and the configuration of the search that proved them. Trees are
+  // not saved, just their fingerprints.
+  bool TransformationCache::Save(const std::string &FileName,
+				 unsigned Version,
+				 const std::string &Configuration) {
+    std::ofstream File(FileName.c_str(), std::ios::out | std::ios::trunc);
+    if (!File)
+      return false;
+    File << "VERSION: " << Version << "\n";
+    File << "CONFIG: " << Configuration << "\n";
+    for (unsigned I = 0; I != NUMSHARDS; ++I) {
+      for (unsigned J = 0, E = Shards[I].Capacity; J != E; ++J) {
+	const CacheEntry &Entry = Shards[I].HashTable[J];
+	// Dead ends under a cost bound are too specific to be worth keeping
+	if (!Entry.Used || Entry.Budget != INT_MAX)
+	  continue;
+	File << Entry.Fingerprint << " " << Entry.ExactFingerprint << " "
+	     << Entry.Depth << "\n";
+      }
+    }
+    return File.good();
+  }
+
+  // Loads dead ends saved by a previous run. Nothing is loaded if the file
+  // is missing or was written for another version or configuration: a
+  // search that explores less may prove dead ends that do not hold for
+  // another one.
+  bool TransformationCache::Load(const std::string &FileName,
+				 unsigned Version,
+				 const std::string &Configuration) {
+    std::ifstream File(FileName.c_str());
+    std::string buf, FileConfiguration;
+    unsigned FileVersion;
+    File >> buf >> FileVersion;
+    if (!File || buf.compare("VERSION:") || FileVersion != Version)
+      return false;
+    File >> buf >> std::ws;
+    std::getline(File, FileConfiguration);
+    if (!File || buf.compare("CONFIG:") ||
+	FileConfiguration != Configuration)
+      return false;
+    unsigned long long Hash, ExactHash;
+    unsigned Depth;
+    while (File >> Hash >> ExactHash >> Depth) {
+      Insert(Hash, ExactHash, NULL, NULL, Depth, INT_MAX);
+    }
+    return true;
+  }
+
+  // Search build options (see the definitions at the top of this file and
+  // the Makefile) and the strategy, all of which change the branches a
+  // search explores
+  std::string Search::getConfiguration(SearchStrategy Strategy) {
+    std::stringstream SS;
+    SS << "strategy=" << Strategy << " reachability=" << REACHABILITY_STEPS
+       << " backward=" << BACKWARD_DEPTH << "," << BACKWARD_FORMS
+       << " egraph=" << EGRAPH_NODES << "," << EGRAPH_ROUNDS;
+#ifdef EXTENSIVESEARCH
+    SS << " extensive";
+#endif
+#ifdef BEST_FIRST_SEARCH
+    SS << " bestfirst";
+#endif
+    return SS.str();
+  }
+
+  // SearchMemo member functions
+
+  // Auxiliary to BuildKey: writes Exp with its operand names replaced by
+  // their order of first occurrence. Everything else the search may look
+  // at (types, sizes, constants, register classes) is written verbatim.
+  void AppendCanonicalTree(const Tree* Exp,
+			   std::map<std::string, unsigned>& Index,
+			   NameListType& Names, std::ostream& Key) {
+    if (Exp->isOperator()) {
+      const Operator* O = static_cast<const Operator*>(Exp);
+      Key << "(" << O->getType() << ":" << O->getSize() << ":"
+	  << O->getReturnTypeType();
+      if (O->isTransferDestination())
+	Key << "*";
+      for (int I = 0, E = O->getArity(); I != E; ++I) {
+	Key << " ";
+	AppendCanonicalTree((*O)[I], Index, Names, Key);
+      }
+      Key << ")";
+      return;
+    }
+    const Operand* O = static_cast<const Operand*>(Exp);
+    Key << "[" << O->getType() << ":" << O->getSize() << ":"
+	<< O->getDataType();
+    if (O->isTransferDestination())
+      Key << "*";
+    if (O->acceptsSpecificReference())
+      Key << "a";
+    switch (O->getKind()) {
+    case ConstantNode:
+      Key << "c" << static_cast<const Constant*>(O)->getConstValue();
+      break;
+    case ImmediateNode:
+      Key << "i";
+      break;
+    case RegisterNode:
+      Key << "r" << static_cast<const void*>
+	(static_cast<const RegisterOperand*>(O)->getRegisterClass());
+      break;
+    default:
+      break;
+    }
+    if (O->isSpecificReference())
+      Key << "s" << O->getOperandName();
+    std::map<std::string, unsigned>::iterator I =
+      Index.find(O->getOperandName());
+    if (I == Index.end()) {
+      I = Index.insert(std::make_pair(O->getOperandName(),
+				      Names.size())).first;
+      Names.push_back(O->getOperandSymbol());
+    }
+    Key << "#" << I->second << "]";
   }
 
-  inline TransformationCache::CacheEntry* TransformationCache::LookUp
-  (const Tree* Exp, const Tree* Target, unsigned Depth) const {
-    unsigned Hash = Exp->getHash(Target->getHash()) % HASHSIZE;
-    CacheEntry* p = HashTable[Hash];
-    while (p) {
-      if (Depth <= p->Depth &&
-	  CacheExactCompare(Target, p->RHS) &&
-          CacheExactCompare(p->LHS, Exp))
-	return p;
-      p = p->next;
+  typedef std::vector<std::pair<std::string, std::string> > KeyEntries;
+
+  // Name of a restricted operand in a memo key: the index of the operand
+  // of the searched expression it is, or is made up from (see
+  // SubstituteLeafs), followed by the rest of its name. Names foreign to
+  // the searched expression give an empty string.
+  std::string KeyName(const Symbol& Name,
+		      const std::map<std::string, unsigned>& Index) {
+    const std::string Text = Name.str();
+    std::map<std::string, unsigned>::const_iterator Pos = Index.find(Text);
+    std::string::size_type Sep = Text.size();
+    for (std::string::size_type S = Text.find('_');
+	 Pos == Index.end() && S != std::string::npos;
+	 S = Text.find('_', S + 1)) {
+      Pos = Index.find(Text.substr(0, S));
+      Sep = S;
     }
-    return NULL;
+    if (Pos == Index.end())
+      return std::string();
+    std::stringstream SS;
+    SS << "#" << Pos->second << Text.substr(Sep);
+    return SS.str();
+  }
+
+  // Indexes the operand names of a searched expression by position
+  void IndexNames(const NameListType& Names,
+		  std::map<std::string, unsigned>& Index) {
+    for (NameListType::const_iterator I = Names.begin(), E = Names.end();
+	 I != E; ++I)
+      Index.insert(std::make_pair(I->str(), Index.size()));
+  }
+
+  // Removes from Map the restrictions on names foreign to the searched
+  // expression that come from the restrictions Context it started with
+  template<class T>
+  void StripForeignNames(RestrictionMap<T>& Map,
+			 const RestrictionMap<T>& Context,
+			 const std::map<std::string, unsigned>& Index) {
+    RestrictionMap<T> Kept;
+    for (typename RestrictionMap<T>::const_iterator I = Map.begin(),
+	   E = Map.end(); I != E; ++I)
+      if (Context.find(I->first) == Context.end() ||
+	  !KeyName(I->first, Index).empty())
+	Kept.push_back(*I);
+    Map.swap(Kept);
+  }
+
+  // Adds to Map the restrictions of Context on names foreign to the
+  // searched expression
+  template<class T>
+  void AddForeignNames(RestrictionMap<T>& Map,
+		       const RestrictionMap<T>& Context,
+		       const std::map<std::string, unsigned>& Index) {
+    for (typename RestrictionMap<T>::const_iterator I = Context.begin(),
+	   E = Context.end(); I != E; ++I)
+      if (KeyName(I->first, Index).empty())
+	Map.push_back(*I);
+  }
+
+  bool KeyEntryLess(const std::pair<std::string, std::string>& A,
+		    const std::pair<std::string, std::string>& B) {
+    return A.first < B.first;
+  }
+
+  // Restrictions are ordered by operand symbol, which depends on the
+  // order names were interned, so entries are written sorted by their
+  // key name. Entries for the same name keep their precedence.
+  void AppendKeyEntries(KeyEntries& Entries, std::ostream& Key) {
+    std::stable_sort(Entries.begin(), Entries.end(), KeyEntryLess);
+    for (KeyEntries::const_iterator I = Entries.begin(), E = Entries.end();
+	 I != E; ++I)
+      Key << " " << I->first << "=" << I->second;
+  }
+
+  // Builds the memo key of a search for Exp, starting with restrictions
+  // ST. Names receives the operand names of Exp, in the order used to
+  // abstract them. Only restrictions on these names, or on names made up
+  // from them, can change the search, so other ones are left out.
+  std::string SearchMemo::BuildKey(const Tree* Exp,
+				   const SearchRestrictions* ST,
+				   NameListType& Names) {
+    std::map<std::string, unsigned> Index;
+    std::stringstream Key;
+    AppendCanonicalTree(Exp, Index, Names, Key);
+    if (ST == NULL)
+      return Key.str();
+    KeyEntries Entries;
+    for (VirtualToRealMap::const_iterator I = ST->getVR()->begin(),
+	   E = ST->getVR()->end(); I != E; ++I) {
+      const std::string Name = KeyName(I->first, Index);
+      if (Name.empty())
+	continue;
+      std::stringstream Value;
+      Value << I->second;
+      Entries.push_back(std::make_pair(Name, Value.str()));
+    }
+    AppendKeyEntries(Entries, Key);
+    Key << " |";
+    Entries.clear();
+    for (VirtualClassesMap::const_iterator I = ST->getVC()->begin(),
+	   E = ST->getVC()->end(); I != E; ++I) {
+      const std::string Name = KeyName(I->first, Index);
+      if (Name.empty())
+	continue;
+      std::stringstream Value;
+      Value << static_cast<const void*>(I->second);
+      Entries.push_back(std::make_pair(Name, Value.str()));
+    }
+    AppendKeyEntries(Entries, Key);
+    return Key.str();
+  }
+
+  typedef std::map<std::string, Symbol> RenameMap;
+
+  // Makes Map translate Name to NewName
+  void BindName(RenameMap& Map, const std::string& Name,
+		const Symbol& NewName) {
+    RenameMap::iterator I = Map.find(Name);
+    if (I != Map.end())
+      I->second = NewName;
+    else
+      Map.insert(std::make_pair(Name, NewName));
+  }
+
+  // Translates an operand name found in a memoized result. Names not known
+  // by Map either are composite (an operand name, '_' and a rule operand
+  // name, see SubstituteLeafs) or were created by rule applications, in
+  // which case they end with a sequence number that is replaced by a fresh
+  // one. Other names, e.g. specific registers, are kept.
+  Symbol RenameOperand(const Symbol& Name, RenameMap& Map) {
+    const std::string Text = Name.str();
+    RenameMap::const_iterator I = Map.find(Text);
+    if (I != Map.end())
+      return I->second;
+    if (Text.compare(0, 6, "CONST<") == 0)
+      return Name;
+    std::string::size_type Sep;
+    for (Sep = Text.find('_'); Sep != std::string::npos;
+	 Sep = Text.find('_', Sep + 1)) {
+      I = Map.find(Text.substr(0, Sep));
+      if (I != Map.end()) {
+	const std::string Renamed = I->second.str() + Text.substr(Sep);
+	return I->second.isTemporary()? Symbol::temporary(Renamed) :
+	  Symbol(Renamed);
+      }
+    }
+    std::string Base = Text;
+    std::string Suffix;
+    Sep = Text.find('_');
+    if (Sep != std::string::npos && Sep > 0) {
+      Base = Text.substr(0, Sep);
+      Suffix = Text.substr(Sep);
+    }
+    std::string::size_type Last = Base.find_last_not_of("0123456789");
+    if (!Name.isTemporary() || Last == Base.size() - 1 ||
+	Last == std::string::npos) {
+      BindName(Map, Text, Name);
+      return Name;
+    }
+    std::stringstream SS;
+    SS << Base.substr(0, Last + 1) << Rule::NextOpNum();
+    BindName(Map, Base, Symbol::temporary(SS.str()));
+    return Symbol::temporary(SS.str() + Suffix);
+  }
+
+  // Renames identifiers inside an operand transformation expression
+  std::string RenameExpression(const std::string& Exp, const RenameMap& Map) {
+    std::string Result;
+    std::string::size_type I = 0, E = Exp.size();
+    while (I != E) {
+      char c = Exp[I];
+      if (!isalnum(c) && c != '_') {
+	Result += c;
+	++I;
+	continue;
+      }
+      std::string::size_type Start = I;
+      while (I != E && (isalnum(Exp[I]) || Exp[I] == '_'))
+	++I;
+      std::string Token = Exp.substr(Start, I - Start);
+      RenameMap::const_iterator Pos = Map.find(Token);
+      Result += (Pos != Map.end())? Pos->second.str() : Token;
+    }
+    return Result;
+  }
+
+  // Counts a search record of type T about to be allocated
+  template<class T>
+  inline void CountAllocation(SearchStats& Stats) {
+    ++Stats.Allocations;
+    if (RecyclingPool<T>::isEmpty())
+      ++Stats.PoolRefills;
+  }
+
+  // Deep copy of a search result, translating its operand names with Map.
+  // When Map is NULL, names are copied verbatim.
+  SearchResult* CopySearchResult(const SearchResult* Source, RenameMap* Map,
+				 SearchStats& Stats) {
+    CountAllocation<SearchResult>(Stats);
+    SearchResult* Result = new SearchResult();
+    Result->Cost = Source->Cost;
+    *Result->Instructions = *Source->Instructions;
+    *Result->RulesApplied = *Source->RulesApplied;
+    for (OperandsDefsType::const_iterator I = Source->OperandsDefs->begin(),
+	   E = Source->OperandsDefs->end(); I != E; ++I) {
+      NameListType* Defs = new NameListType();
+      for (NameListType::const_iterator I2 = (*I)->begin(),
+	     E2 = (*I)->end(); I2 != E2; ++I2)
+	Defs->push_back(Map? RenameOperand(*I2, *Map) : *I2);
+      Result->OperandsDefs->push_back(Defs);
+    }
+    for (VirtualToRealMap::const_iterator I = Source->ST->getVR()->begin(),
+	   E = Source->ST->getVR()->end(); I != E; ++I)
+      Result->ST->getVR()->push_back
+	(std::make_pair(Map? RenameOperand(I->first, *Map) : I->first,
+			I->second));
+    for (VirtualClassesMap::const_iterator I = Source->ST->getVC()->begin(),
+	   E = Source->ST->getVC()->end(); I != E; ++I)
+      Result->ST->getVC()->push_back
+	(std::make_pair(Map? RenameOperand(I->first, *Map) : I->first,
+			I->second));
+    *Result->OpTrans = *Source->OpTrans;
+    if (Map == NULL)
+      return Result;
+    for (OpTransLists::iterator I = Result->OpTrans->begin(),
+	   E = Result->OpTrans->end(); I != E; ++I) {
+      for (OperandTransformationList::iterator I2 = I->begin(),
+	     E2 = I->end(); I2 != E2; ++I2) {
+	I2->LHSOperand = RenameOperand(I2->LHSOperand, *Map).str();
+	I2->TransformExpression = RenameExpression(I2->TransformExpression,
+						   *Map);
+      }
+    }
+    return Result;
+  }
+
+  SearchMemo::~SearchMemo() {
+    Clear();
+  }
+
+  void SearchMemo::Clear() {
+    for (std::map<std::string, MemoEntry>::iterator I = Table.begin(),
+	   E = Table.end(); I != E; ++I)
+      delete I->second.Result;
+    Table.clear();
+  }
+
+  // Searches limited by the maximum depth are only valid for the very same
+  // depth, others are kept under a single entry
+  std::string SearchMemo::TableKey(const std::string& Key, unsigned Depth,
+				   bool Bounded) {
+    std::stringstream SS;
+    SS << Key << " @";
+    if (Bounded)
+      SS << Depth;
+    else
+      SS << "*";
+    return SS.str();
+  }
+
+  // Returns a copy of the memoized result for Key and Depth levels left to
+  // explore, renamed to the operand names of the expression being searched,
+  // or NULL if there is none. Bounded tells whether the result found was
+  // limited by the maximum depth.
+  SearchResult* SearchMemo::LookUp(const std::string& Key, unsigned Depth,
+				   const NameListType& Names,
+				   const SearchRestrictions* ST,
+				   bool& Bounded, SearchStats& Stats) {
+    SearchResult* Result = NULL;
+#ifdef PARALLEL_SEARCH
+#pragma omp critical (SearchMemo)
+#endif
+    {
+      std::map<std::string, MemoEntry>::const_iterator Pos =
+	Table.find(TableKey(Key, Depth, false));
+      Bounded = false;
+      if (Pos == Table.end() || Pos->second.Depth > Depth) {
+	Pos = Table.find(TableKey(Key, Depth, true));
+	Bounded = true;
+      }
+      if (Pos != Table.end()) {
+	RenameMap Map;
+	for (NameListType::const_iterator I = Pos->second.Names.begin(),
+	       E = Pos->second.Names.end(), I2 = Names.begin();
+	     I != E; ++I, ++I2)
+	  BindName(Map, *I, *I2);
+	Result = CopySearchResult(Pos->second.Result, &Map, Stats);
+      }
+    }
+    // Restrictions on names foreign to the expression are not part of the
+    // key and were left out of the stored result (see Add), they are
+    // taken from this search instead
+    if (Result != NULL && ST != NULL) {
+      std::map<std::string, unsigned> Index;
+      IndexNames(Names, Index);
+      AddForeignNames(*Result->ST->getVR(), *ST->getVR(), Index);
+      AddForeignNames(*Result->ST->getVC(), *ST->getVC(), Index);
+    }
+    return Result;
+  }
+
+  // Stores SR, the result of a search that started with restrictions ST
+  void SearchMemo::Add(const std::string& Key, unsigned Depth, bool Bounded,
+		       const NameListType& Names, const SearchResult* SR,
+		       const SearchRestrictions* ST, SearchStats& Stats) {
+    SearchResult* Copy = CopySearchResult(SR, NULL, Stats);
+    if (ST != NULL) {
+      std::map<std::string, unsigned> Index;
+      IndexNames(Names, Index);
+      StripForeignNames(*Copy->ST->getVR(), *ST->getVR(), Index);
+      StripForeignNames(*Copy->ST->getVC(), *ST->getVC(), Index);
+    }
+#ifdef PARALLEL_SEARCH
+#pragma omp critical (SearchMemo)
+#endif
+    {
+      const std::string FullKey = TableKey(Key, Depth, Bounded);
+      std::map<std::string, MemoEntry>::iterator Pos = Table.find(FullKey);
+      if (Pos == Table.end()) {
+	MemoEntry& Entry = Table[FullKey];
+	Entry.Result = Copy;
+	Entry.Names = Names;
+	Entry.Depth = Depth;
+	Copy = NULL;
+      } else if (Pos->second.Depth > Depth) {
+	// Same search, found unbounded with less depth
+	Pos->second.Depth = Depth;
+      }
+    }
+    if (Copy != NULL)
+      delete Copy;
   }
 
   // SearchRestrictions member functions
 
   // Constructor
-  SearchRestrictions::SearchRestrictions(VirtualToRealMap* vr,
-					 VirtualClassesMap* vc){
-    VR = vr;
-    VC = vc;
-    if (VR == 0)
-      VR = new VirtualToRealMap();
-    if (VC == 0)
-      VC = new VirtualClassesMap();
+  void* SearchRestrictions::operator new(size_t Size) {
+    return RecyclingPool<SearchRestrictions>::allocate(Size);
   }
 
-  SearchRestrictions::~SearchRestrictions() {
-    setVR(0);
-    setVC(0);
+  void SearchRestrictions::operator delete(void* P) {
+    RecyclingPool<SearchRestrictions>::release(P);
   }
 
   const VirtualToRealMap* SearchRestrictions::getVR() const {
-    return VR;
+    return &VR;
   }
   
   const VirtualClassesMap* SearchRestrictions::getVC() const {
-    return VC;
-  }
-
-  void SearchRestrictions::setVR(VirtualToRealMap* e) {
-    if (VR)
-      delete VR;
-    VR = e;
-  }
-
-  void SearchRestrictions::setVC(VirtualClassesMap* e) {
-    if (VC)
-      delete VC;
-    VC = e;
+    return &VC;
   }
   // SearchRestrictions' VirtualToRealMap related auxiliary functions
 
@@ -471,28 +1058,23 @@ namespace backendgen {
   // mapping. But if the virtual register is already mapped, returns false.
   inline
   bool SearchRestrictions::AddToVRList(RegPair Element) {
-    if (!VR)
-      VR = new VirtualToRealMap();
-    for (VirtualToRealMap::const_iterator I = VR->begin(), E = VR->end();
-	 I != E; ++I) {
-      if (I->first == Element.first && I->second != Element.second)
-	return false;
-      else if (I->first == Element.first && I->second == Element.second)
-	return true;
-    }
-    VR->push_back(Element);
+    VirtualToRealMap::const_iterator I = VR.find(Element.first);
+    if (I != VR.end())
+      return I->second == Element.second;
+    if (BaseVR != NULL && (I = BaseVR->find(Element.first)) != BaseVR->end())
+      return I->second == Element.second;
+    VR.push_back(Element);
     return true;
   }
 
   inline
-  bool SearchRestrictions::LookupVR(const std::string& Key,
-				    const std::string* Result) const {
-    for (VirtualToRealMap::const_iterator I = VR->begin(), E = VR->end();
-	 I != E; ++I) {
-      if (I->first == Key) {
-	Result = &I->second;
-	return true;
-      }
+  bool SearchRestrictions::LookupVR(const Symbol& Key,
+				    const Symbol*& Result) const {
+    VirtualToRealMap::const_iterator I = VR.find(Key);
+    if (I != VR.end() ||
+	(BaseVR != NULL && (I = BaseVR->find(Key)) != BaseVR->end())) {
+      Result = &I->second;
+      return true;
     }
     Result = 0;
     return false;
@@ -507,28 +1089,15 @@ namespace backendgen {
 						       VirtualToRealMap* B)
     const
   {
-    const VirtualToRealMap *A = VR;
-    if (A == NULL || B == NULL)
+    if (B == NULL)
       return false;
-
-    for (VirtualToRealMap::const_iterator I = A->begin(), E = A->end();
-	 I != E; ++I) {
-      for (VirtualToRealMap::const_iterator I2 = B->begin(), E2 = B->end();
-	   I2 != E2; ++ I2) {
-	if (I->first == I2->first && I->second != I2->second)
-	  return true;
-      }
-    }
-
-    return false;
+    return VR.conflictsWith(*B);
   }
 
   inline
   bool SearchRestrictions::HasConflictingDefinitions(const 
 						     SearchRestrictions* B)
     const {
-    if (this == NULL)
-      return false;
     if (B == NULL)
       return false;
     return (HasConflictingVRDefinitions(B->getVR()) ||
@@ -538,26 +1107,18 @@ namespace backendgen {
   
   inline 
   void SearchRestrictions::MergeVRList(const VirtualToRealMap* Source){
-    VirtualToRealMap *Destination = VR;
     if (Source != 0) 
-      Destination->insert(Destination->begin(), Source->begin(),
-			  Source->end());
+      VR.merge(*Source);
   }
 
   // SearchRestrictions' VirtualClassesMap related auxiliary functions
 
   inline
   bool SearchRestrictions::AddToVCList(VCPair Element) {
-    if (!VC)
-      VC = new VirtualClassesMap();
-    for (VirtualClassesMap::const_iterator I = VC->begin(), E = VC->end();
-	 I != E; ++I) {
-      if (I->first == Element.first && I->second != Element.second)
-	return false;
-      else if (I->first == Element.first && I->second == Element.second)
-	return true;
-    }
-    VC->push_back(Element);
+    VirtualClassesMap::const_iterator I = VC.find(Element.first);
+    if (I != VC.end())
+      return I->second == Element.second;
+    VC.push_back(Element);
     return true;
   }
 
@@ -569,31 +1130,18 @@ namespace backendgen {
 						       VirtualClassesMap* B)
   const
   {
-    const VirtualClassesMap *A = VC;
-    if (A == NULL || B == NULL)
+    if (B == NULL)
       return false;
-
-    for (VirtualClassesMap::const_iterator I = A->begin(), E = A->end();
-	 I != E; ++I) {
-      for (VirtualClassesMap::const_iterator I2 = B->begin(), E2 = B->end();
-	   I2 != E2; ++ I2) {
-	if (I->first == I2->first && I->second != I2->second)
-	  return true;
-      }
-    }
-
-    return false;
+    return VC.conflictsWith(*B);
   }
 
   inline
-  bool SearchRestrictions::LookupVC(const std::string& Key,
+  bool SearchRestrictions::LookupVC(const Symbol& Key,
 				    const RegisterClass* Result) const {
-    for (VirtualClassesMap::const_iterator I = VC->begin(), E = VC->end();
-	 I != E; ++I) {
-      if (I->first == Key) {
-	Result = I->second;
-	return true;
-      }
+    VirtualClassesMap::const_iterator I = VC.find(Key);
+    if (I != VC.end()) {
+      Result = I->second;
+      return true;
     }
     Result = 0;
     return false;
@@ -601,10 +1149,8 @@ namespace backendgen {
 
   inline 
   void SearchRestrictions::MergeVCList(const VirtualClassesMap* Source){
-    VirtualClassesMap *Destination = VC;
     if (Source != 0) 
-      Destination->insert(Destination->begin(), Source->begin(),
-			  Source->end());
+      VC.merge(*Source);
   }
 
   inline 
@@ -615,9 +1161,48 @@ namespace backendgen {
     }
   }
 
+  inline
+  void SearchRestrictions::Swap(SearchRestrictions& B) {
+    VR.swap(B.VR);
+    VC.swap(B.VC);
+  }
+
+  inline
+  void SearchRestrictions::Clear() {
+    VR.clear();
+    VC.clear();
+    BaseVR = NULL;
+  }
+
+
+
 
 
+  void TrimSearchPools() {
+    RecyclingPool<SearchResult>::trim();
+    RecyclingPool<SearchRestrictions>::trim();
+  }
+
+  void CollectOperandNames(const Tree* Exp, std::set<std::string>& Names) {
+    if (Exp->isOperand()) {
+      Names.insert(static_cast<const Operand*>(Exp)->getOperandName());
+      return;
+    }
+    const Operator* O = static_cast<const Operator*>(Exp);
+    for (int I = 0, E = O->getArity(); I != E; ++I)
+      CollectOperandNames((*O)[I], Names);
+  }
 
+  bool IsDetermined(const Tree* Pattern, const std::set<std::string>& Names) {
+    if (Pattern->isOperand())
+      return Pattern->getKind() == ConstantNode ||
+	Names.count(static_cast<const Operand*>(Pattern)->getOperandName());
+    const Operator* O = static_cast<const Operator*>(Pattern);
+    for (int I = 0, E = O->getArity(); I != E; ++I)
+      if (!IsDetermined((*O)[I], Names))
+	return false;
+    return true;
+  }
 
   // Search member functions
 
@@ -628,16 +1213,213 @@ namespace backendgen {
   { 
     MaxDepth = 10; // default search depth, if none specified this will be
                    // used
+    Cutoffs = 0;
+    BudgetCuts = 0;
+    MinInsnCost = INT_MAX;
+    for (InstrIterator I = InstructionsMgr.getBegin(),
+	   E = InstructionsMgr.getEnd(); I != E; ++I)
+      if ((*I)->getCost() < MinInsnCost)
+	MinInsnCost = (*I)->getCost();
+    Strategy = DepthFirstStrategy;
+    InitialDepth = 1;
+    DepthStep = 1;
+    Limits = &OwnLimits;
+    setBudget(0, 0);
+    SharedBound = NULL;
+    TaskCost = 0;
+    StartCutoffs = 0;
+    SaturatedSource = SaturatedForm = NULL;
+    CloseSets = &OwnCloseSets;
+    InstructionsMgr.BuildSemanticIndex();
+    RulesMgr.BuildReachability(REACHABILITY_STEPS);
+    RulesMgr.BuildRuleIndex();
+  }
+
+  Search::Search(Search* Parent):
+    RulesMgr(Parent->RulesMgr), InstructionsMgr(Parent->InstructionsMgr)
+  {
+    MaxDepth = Parent->MaxDepth;
+    Cutoffs = 0;
+    BudgetCuts = 0;
+    MinInsnCost = Parent->MinInsnCost;
+    Strategy = Parent->Strategy;
+    InitialDepth = Parent->InitialDepth;
+    DepthStep = Parent->DepthStep;
+    Limits = Parent->Limits;
+    SharedBound = Parent->SharedBound;
+    TaskCost = Parent->TaskCost;
+    StartCutoffs = 0;
+    SaturatedSource = SaturatedForm = NULL;
+    CloseSets = Parent->CloseSets;
+  }
+
+  void Search::setBudget(double Seconds, unsigned long long Nodes) {
+    Limits->Deadline = Seconds > 0? WallTime() + Seconds : 0;
+    Limits->MaxNodes = Nodes;
+    Limits->Nodes = 0;
+    Limits->Exhausted = false;
+  }
+
+  // Counts an expanded node and tells if the budget ran out. Conclusions
+  // drawn after that are not cached, as the search was not complete.
+  inline bool Search::OutOfBudget() {
+    SearchLimits* L = Limits;
+    if (L->isExhausted() || isLosing())
+      return true;
+    if (L->Deadline == 0 && L->MaxNodes == 0)
+      return false;
+    const unsigned long long N = __sync_add_and_fetch(&L->Nodes, 1);
+    if ((L->MaxNodes != 0 && N > L->MaxNodes) ||
+	(L->Deadline != 0 && N % CLOCK_CHECK_INTERVAL == 0 &&
+	 WallTime() > L->Deadline))
+      L->setExhausted();
+    return L->isExhausted();
+  }
+
+  // Tells whether this parallel task can no longer find an implementation
+  // as cheap as the one other tasks found (see SharedBound). Nothing it
+  // finds afterwards matters, so it stops as if out of budget.
+  inline bool Search::isLosing() const {
+#ifdef PARALLEL_SEARCH
+    if (SharedBound == NULL)
+      return false;
+    CostType Best;
+#pragma omp atomic read
+    Best = *SharedBound;
+    return Best < TaskCost;
+#else
+    return false;
+#endif
+  }
+
+  // Lowers Budget, the budget of the transformation a parallel task
+  // started with, to what the lowest cost found by other tasks leaves
+  inline void Search::ApplySharedBound(CostType& Budget) const {
+#ifdef PARALLEL_SEARCH
+    if (SharedBound == NULL)
+      return;
+    CostType Best;
+#pragma omp atomic read
+    Best = *SharedBound;
+    if (Best >= TaskCost && Best - TaskCost < Budget)
+      Budget = Best - TaskCost;
+#endif
+  }
+
+  // Conclusions drawn after the search stopped early are incomplete and
+  // must not be cached or memoized
+  inline bool Search::isStopped() const {
+    return Limits->isExhausted() || isLosing();
+  }
+
+  SearchStatus Search::getStatus(const SearchResult* R) const {
+    if (R != NULL && R->Instructions->size() != 0)
+      return SearchFound;
+    if (Limits->isExhausted())
+      return SearchOutOfBudget;
+    if (Cutoffs != StartCutoffs)
+      return SearchDepthLimited;
+    return SearchImpossible;
+  }
+
+  const char* getStatusName(SearchStatus Status) {
+    switch (Status) {
+    case SearchFound:
+      return "found";
+    case SearchDepthLimited:
+      return "depth limited";
+    case SearchOutOfBudget:
+      return "out of budget";
+    case SearchImpossible:
+      return "impossible";
+    }
+    return "unknown";
+  }
+
+  // SearchStats member functions
+  SearchStats::SearchStats(): Compares(0), Decompositions(0),
+			      DecompositionSuccesses(0), CacheHits(0),
+			      CacheMisses(0), MemoHits(0), MemoMisses(0),
+			      Allocations(0), PoolRefills(0) {}
+
+  // Adds B to A, element by element
+  void MergeCounters(std::vector<unsigned long long>& A,
+		     const std::vector<unsigned long long>& B) {
+    if (A.size() < B.size())
+      A.resize(B.size(), 0);
+    for (unsigned I = 0, E = B.size(); I != E; ++I)
+      A[I] += B[I];
+  }
+
+  void SearchStats::Merge(const SearchStats& Other) {
+    MergeCounters(Nodes, Other.Nodes);
+    Compares += Other.Compares;
+    MergeCounters(RuleAttempts, Other.RuleAttempts);
+    MergeCounters(RuleSuccesses, Other.RuleSuccesses);
+    Decompositions += Other.Decompositions;
+    DecompositionSuccesses += Other.DecompositionSuccesses;
+    CacheHits += Other.CacheHits;
+    CacheMisses += Other.CacheMisses;
+    MemoHits += Other.MemoHits;
+    MemoMisses += Other.MemoMisses;
+    Allocations += Other.Allocations;
+    PoolRefills += Other.PoolRefills;
+    for (std::map<unsigned, double>::const_iterator
+	   I = Other.DepthTimes.begin(), E = Other.DepthTimes.end();
+	 I != E; ++I)
+      DepthTimes[I->first] += I->second;
+  }
+
+  void SearchStats::PrintJSON(std::ostream& O) const {
+    O << "{\"nodes\": [";
+    for (unsigned I = 0, E = Nodes.size(); I != E; ++I)
+      O << (I == 0? "" : ", ") << Nodes[I];
+    O << "], \"compares\": " << Compares << ", \"rules\": [";
+    bool First = true;
+    for (unsigned I = 0, E = RuleAttempts.size(); I != E; ++I) {
+      if (RuleAttempts[I] == 0)
+	continue;
+      O << (First? "" : ", ") << "{\"id\": " << I << ", \"attempts\": "
+	<< RuleAttempts[I] << ", \"successes\": " << RuleSuccesses[I] << "}";
+      First = false;
+    }
+    O << "], \"decompositions\": {\"attempts\": " << Decompositions
+      << ", \"successes\": " << DecompositionSuccesses
+      << "}, \"dead_end_cache\": {\"hits\": " << CacheHits
+      << ", \"misses\": " << CacheMisses
+      << "}, \"memo\": {\"hits\": " << MemoHits
+      << ", \"misses\": " << MemoMisses
+      << "}, \"allocations\": {\"records\": " << Allocations
+      << ", \"pool_refills\": " << PoolRefills << "}, \"depth_times\": [";
+    for (std::map<unsigned, double>::const_iterator I = DepthTimes.begin(),
+	   E = DepthTimes.end(); I != E; ++I)
+      O << (I == DepthTimes.begin()? "" : ", ") << "{\"depth\": "
+	<< I->first << ", \"seconds\": " << I->second << "}";
+    O << "]}";
+  }
+
+  inline void Search::CountNode(unsigned CurDepth) {
+    if (Stats.Nodes.size() <= CurDepth)
+      Stats.Nodes.resize(CurDepth + 1, 0);
+    ++Stats.Nodes[CurDepth];
+  }
+
+  inline void Search::CountRuleAttempt(unsigned RuleID) {
+    if (Stats.RuleAttempts.size() <= RuleID) {
+      Stats.RuleAttempts.resize(RuleID + 1, 0);
+      Stats.RuleSuccesses.resize(RuleID + 1, 0);
+    }
+    ++Stats.RuleAttempts[RuleID];
+  }
+
+  inline SearchResult* Search::NewResult() {
+    CountAllocation<SearchResult>(Stats);
+    return new SearchResult();
   }
   
   inline bool CheckForConstInVRList(VirtualToRealMap *VR, 
-				    const std::string &Name) {
-    VirtualToRealMap::iterator I, E;
-    for (I = VR->begin(), E = VR->end(); I != E; ++I) {
-      if (I->first == Name) {
-	break;
-      }
-    }
+				    const Symbol &Name) {
+    VirtualToRealMap::iterator I = VR->find(Name);
     // Not found
     if (I == VR->end())
       return false;
@@ -660,9 +1442,9 @@ namespace backendgen {
     if (Exp->isOperand()) {
       // Constants may be emitted as operands in special cases identified
       // with help of VirtualToRealMap.
-      const Constant* CExp;
-      if ((CExp = dynamic_cast<const Constant*>(Exp)) != NULL) {
-	if (!CheckForConstInVRList(VR, CExp->getOperandName())) 
+      if (Exp->getKind() == ConstantNode) {
+	const Constant* CExp = static_cast<const Constant*>(Exp);
+	if (!CheckForConstInVRList(VR, CExp->getOperandSymbol())) 
 	  return Result;
 	// This constant was bound to an immediate and must be emmited as 
 	// operand
@@ -672,15 +1454,15 @@ namespace backendgen {
 	return Result;
       }
       // We should not expect fragments to be present here
-      assert(dynamic_cast<const FragOperand*>(Exp) == NULL &&
+      assert(Exp->getKind() != FragOperandNode &&
 	     "Unexpected node type.");
-      const Operand* O = dynamic_cast<const Operand*>(Exp);
-      Result->push_back(O->getOperandName());
+      const Operand* O = static_cast<const Operand*>(Exp);
+      Result->push_back(O->getOperandSymbol());
       return Result;
     }
 
     // An operator
-    const Operator* O = dynamic_cast<const Operator*>(Exp);    
+    const Operator* O = static_cast<const Operator*>(Exp);    
     for (int I = 0, E = O->getArity(); I != E; ++I) 
       {
 	NameListType* ChildResult = ExtractLeafsNames((*O)[I], VR);
@@ -702,38 +1484,351 @@ namespace backendgen {
     delete List;
   }
 
-  // Extracts an expression's primary operator type
-  inline unsigned PrimaryOperatorType (const Tree* Expression)
+  inline bool Search::HasCloseSemantic(unsigned InstrPO, unsigned ExpPO)
   {
-    if (!Expression->isOperator())
-      return 0;
+    // See if primary operators match naturally or will match after
+    // transformations (see TransformationRules::BuildReachability)
+    return RulesMgr.CanReach(ExpPO, InstrPO);
+  }
 
-    const Operator* O = dynamic_cast<const Operator*>(Expression);
-    if (O->getType() == AssignOp) {      
-      return PrimaryOperatorType((*O)[1]);
-    }    
+  // Our binary predicate to sort candidates by instruction cost, then in
+  // instruction order
+  class CandidatesComparator {
+  public:
+    bool operator() (const SemanticCandidate& A,
+		     const SemanticCandidate& B) const {
+      if (A.Insn->getCost() != B.Insn->getCost())
+	return A.Insn->getCost() < B.Insn->getCost();
+      return A.SeqNum < B.SeqNum;
+    }
+  };
+
+  // Adds to List the instruction semantics an expression with primary
+  // operator type ExpPO may be transformed into, cheapest first, so that
+  // a good bound is found early. Semantics rejected by the CloseSemantic
+  // heuristic are left out.
+  void Search::BuildCloseCandidates(unsigned ExpPO, CandidateList& List) {
+    for (SemanticIndexTy::const_iterator I = InstructionsMgr.getIndexBegin(),
+	   E = InstructionsMgr.getIndexEnd(); I != E; ++I) {
+#ifndef EXTENSIVESEARCH
+      if (!HasCloseSemantic(I->first.first, ExpPO))
+	continue;
+#endif
+      List.insert(List.end(), I->second.begin(), I->second.end());
+    }
+    std::sort(List.begin(), List.end(), CandidatesComparator());
+  }
 
-    return O->getType();
+  // Builds the close candidates of every primary operator type before the
+  // search starts, so parallel tasks only read them. Only types of rules
+  // and semantics, and leaves, have lists of their own: reachability
+  // treats all other types alike (see TransformationRules::getDistance).
+  void Search::BuildCloseSets() {
+    std::set<unsigned> Types;
+    Types.insert(0);
+    for (RuleIterator I = RulesMgr.getBegin(), E = RulesMgr.getEnd(); I != E;
+	 ++I) {
+      Types.insert(PrimaryOperatorType(I->LHS));
+      Types.insert(PrimaryOperatorType(I->RHS));
+    }
+    for (SemanticIndexTy::const_iterator I = InstructionsMgr.getIndexBegin(),
+	   E = InstructionsMgr.getIndexEnd(); I != E; ++I)
+      Types.insert(I->first.first);
+    // An unused type stands for the others
+    unsigned Other = 1;
+    while (Types.count(Other))
+      ++Other;
+    BuildCloseCandidates(Other, CloseSets->OtherCandidates);
+    for (std::set<unsigned>::const_iterator I = Types.begin(),
+	   E = Types.end(); I != E; ++I)
+      BuildCloseCandidates(*I, CloseSets->Candidates[*I]);
+    CloseSets->Built = true;
   }
 
-  inline bool Search::HasCloseSemantic(unsigned InstrPO, unsigned ExpPO)
-  {
-    // See if primary operators match naturally
-    if (EqualTypes(InstrPO, ExpPO))
+  // Returns the instruction semantics an expression with primary operator
+  // type ExpPO may be transformed into (see BuildCloseCandidates)
+  inline
+  const CandidateList& Search::getCloseCandidates(unsigned ExpPO) const {
+    assert (CloseSets->Built && "Close semantics must be built first");
+    std::map<unsigned, CandidateList>::const_iterator Pos =
+      CloseSets->Candidates.find(ExpPO);
+    return Pos != CloseSets->Candidates.end()? Pos->second :
+      CloseSets->OtherCandidates;
+  }
+
+  // A rule and the direction it is applied in
+  typedef std::vector<std::pair<const Rule*, bool> > DirectedRules;
+
+  // Adds to Forms the trees obtained by applying one of Rules to a node of
+  // T, a shared tree, and the rule applied. Transfer destinations are not
+  // rewritten. New trees are shared.
+  void RewriteOnce(const Tree* T, const DirectedRules& Rules,
+		   std::vector<std::pair<const Tree*, unsigned> >& Forms) {
+    for (DirectedRules::const_iterator I = Rules.begin(), E = Rules.end();
+	 I != E; ++I) {
+      Tree* New = I->second? I->first->ForwardApply(T) :
+	I->first->BackwardApply(T);
+      if (New == NULL)
+	continue;
+      Forms.push_back(std::make_pair(NodeFactory::Instance().intern(New),
+				     I->first->RuleID));
+      delete New;
+    }
+    if (!T->isOperator())
+      return;
+    const Operator* O = static_cast<const Operator*>(T);
+    for (int I = O->isAssignOp()? 1 : 0, E = O->getArity(); I != E; ++I) {
+      std::vector<std::pair<const Tree*, unsigned> > ChildForms;
+      RewriteOnce((*O)[I], Rules, ChildForms);
+      for (unsigned C = 0, CE = ChildForms.size(); C != CE; ++C) {
+	// Other children stay shared with T
+	Operator* Copy = static_cast<Operator*>(T->clone());
+	Copy->setChild(I, const_cast<Tree*>(ChildForms[C].first));
+	Forms.push_back(std::make_pair(NodeFactory::Instance().intern(Copy),
+				       ChildForms[C].second));
+	delete Copy;
+      }
+    }
+  }
+
+  class BackwardFormsComparator {
+  public:
+    bool operator() (const BackwardForm& A, const BackwardForm& B) const {
+      if (A.Insn->getCost() != B.Insn->getCost())
+	return A.Insn->getCost() < B.Insn->getCost();
+      if (A.SeqNum != B.SeqNum)
+	return A.SeqNum < B.SeqNum;
+      return A.Rules.size() < B.Rules.size();
+    }
+  };
+
+  // Appends to Slots the index in Names of the operand name of each leaf
+  // of T that is not a constant, in preorder (see BackwardForm). Names not
+  // found are added if Add is set; otherwise false is returned.
+  bool CollectLeafSlots(const Tree* T, std::vector<Symbol>& Names, bool Add,
+			std::vector<unsigned>& Slots) {
+    if (T->isOperator()) {
+      const Operator* O = static_cast<const Operator*>(T);
+      for (int I = 0, E = O->getArity(); I != E; ++I)
+	if (!CollectLeafSlots((*O)[I], Names, Add, Slots))
+	  return false;
+      return true;
+    }
+    if (T->getKind() == ConstantNode)
       return true;
+    const Symbol Name = static_cast<const Operand*>(T)->getOperandSymbol();
+    unsigned Slot = std::find(Names.begin(), Names.end(), Name) -
+      Names.begin();
+    if (Slot == Names.size()) {
+      if (!Add)
+	return false;
+      Names.push_back(Name);
+    }
+    Slots.push_back(Slot);
+    return true;
+  }
 
-    // See if primary operators will match after a transformation
-    for (RuleIterator I = RulesMgr.getBegin(), E = RulesMgr.getEnd();
+  // Applies equivalence rules, in both directions, to each instruction
+  // semantic, breadth first, up to BACKWARD_DEPTH times and keeping up to
+  // BACKWARD_FORMS forms. As in the e-graph, only rules matching an
+  // operator and naming no new operand are used, so forms have no operand
+  // their semantic does not have. Forms missing an operand of their
+  // semantic are dropped, as a match could not bind it. Forms are sorted
+  // cheapest first.
+  void Search::BuildBackwardForms(BackwardFormList& Forms) {
+    DirectedRules Rules;
+    for (RuleIterator I = RulesMgr.getBegin(), E = RulesMgr.getEnd(); I != E;
+	 ++I) {
+      if (!I->Equivalence || I->Decomposition || I->Composition ||
+	  !I->OpTransList.empty())
+	continue;
+      std::set<std::string> LHSNames, RHSNames;
+      CollectOperandNames(I->LHS, LHSNames);
+      CollectOperandNames(I->RHS, RHSNames);
+      if (I->LHS->isOperator() && IsDetermined(I->RHS, LHSNames))
+	Rules.push_back(std::make_pair(&*I, true));
+      if (I->RHS->isOperator() && IsDetermined(I->LHS, RHSNames))
+	Rules.push_back(std::make_pair(&*I, false));
+    }
+    unsigned SeqNum = 0;
+    for (InstrIterator I = InstructionsMgr.getBegin(),
+	   E = InstructionsMgr.getEnd(); I != E; ++I) {
+      for (SemanticIterator I2 = (*I)->getBegin(), E2 = (*I)->getEnd();
+	   I2 != E2; ++I2, ++SeqNum) {
+	BackwardForm Semantic;
+	Semantic.Insn = *I;
+	Semantic.Sem = I2;
+	Semantic.SeqNum = SeqNum;
+	Semantic.Form = NodeFactory::Instance().intern(I2->SemanticExpression);
+	std::vector<Symbol> Names;
+	CollectLeafSlots(Semantic.Form, Names, true, Semantic.SemSlots);
+	Semantic.NumOperands = Names.size();
+	std::set<const Tree*> Seen;
+	Seen.insert(Semantic.Form);
+	std::vector<BackwardForm> Level(1, Semantic);
+	unsigned Found = 0;
+	for (unsigned Depth = 0; Depth != BACKWARD_DEPTH &&
+	       Found != BACKWARD_FORMS; ++Depth) {
+	  std::vector<BackwardForm> Next;
+	  for (unsigned L = 0, LE = Level.size();
+	       L != LE && Found != BACKWARD_FORMS; ++L) {
+	    std::vector<std::pair<const Tree*, unsigned> > Rewritten;
+	    RewriteOnce(Level[L].Form, Rules, Rewritten);
+	    for (unsigned F = 0, FE = Rewritten.size();
+		 F != FE && Found != BACKWARD_FORMS; ++F) {
+	      if (!Seen.insert(Rewritten[F].first).second)
+		continue;
+	      // The rule leading back comes first
+	      BackwardForm New = Level[L];
+	      New.Form = Rewritten[F].first;
+	      New.Rules.push_front(Rewritten[F].second);
+	      New.FormSlots.clear();
+	      if (!CollectLeafSlots(New.Form, Names, false, New.FormSlots))
+		continue;
+	      std::vector<bool> Bound(New.NumOperands, false);
+	      for (unsigned S = 0, SE = New.FormSlots.size(); S != SE; ++S)
+		Bound[New.FormSlots[S]] = true;
+	      if (std::find(Bound.begin(), Bound.end(), false) != Bound.end())
+		continue;
+	      Next.push_back(New);
+	      Forms.push_back(New);
+	      ++Found;
+	    }
+	  }
+	  Level.swap(Next);
+	}
+      }
+    }
+    std::sort(Forms.begin(), Forms.end(), BackwardFormsComparator());
+  }
+
+  // Backward forms of the semantics of InstructionsMgr, built on first use
+  // for the rules of RulesMgr and kept by InstructionsMgr
+  const BackwardFormList& Search::getBackwardForms() {
+#ifdef PARALLEL_SEARCH
+#pragma omp critical (BackwardForms)
+#endif
+    if (!InstructionsMgr.hasBackwardForms(&RulesMgr, RulesMgr.getNumRules())) {
+      BackwardFormList Forms;
+      BuildBackwardForms(Forms);
+      InstructionsMgr.setBackwardForms(Forms, &RulesMgr,
+				       RulesMgr.getNumRules());
+    }
+    return InstructionsMgr.getBackwardForms();
+  }
+
+  // Backward forms an expression with primary operator type ExpPO may be
+  // transformed into, cheapest first (see getCloseCandidates)
+  // Forms are copied, so lists stay valid if the forms of InstructionsMgr
+  // are rebuilt.
+  const BackwardFormList& Search::getCloseBackwardForms(unsigned ExpPO) {
+    BackwardFormList* List;
+#ifdef PARALLEL_SEARCH
+#pragma omp critical (CloseSemantics)
+#endif
+    {
+      std::map<unsigned, BackwardFormList>::iterator Pos =
+	CloseSets->BackwardForms.find(ExpPO);
+      if (Pos != CloseSets->BackwardForms.end()) {
+	List = &Pos->second;
+      } else {
+	const BackwardFormList& Forms = getBackwardForms();
+	List = &CloseSets->BackwardForms[ExpPO];
+	for (BackwardFormList::const_iterator I = Forms.begin(),
+	       E = Forms.end(); I != E; ++I) {
+#ifndef EXTENSIVESEARCH
+	  if (!HasCloseSemantic(PrimaryOperatorType(I->Form), ExpPO))
+	    continue;
+#endif
+	  List->push_back(*I);
+	}
+      }
+    }
+    return *List;
+  }
+
+  // Puts the operand definitions made by a match of F.Form, the list under
+  // construction in R, in the order of the leaves of the semantic of F,
+  // which is the order PatternTranslator::sortOperandsDefs expects.
+  // Returns false if the match did not define one operand per leaf of the
+  // form or bound leaves of the same operand to different names.
+  bool MapBackwardFormOperands(const BackwardForm& F, SearchResult* R) {
+    if (R->OperandsDefs->size() <= R->Instructions->size())
+      return false;
+    NameListType* Defs = R->OperandsDefs->back();
+    if (Defs->size() != F.FormSlots.size())
+      return false;
+    std::vector<const Symbol*> Bound(F.NumOperands,
+				     static_cast<const Symbol*>(NULL));
+    unsigned Leaf = 0;
+    for (NameListType::const_iterator I = Defs->begin(), E = Defs->end();
+	 I != E; ++I, ++Leaf) {
+      const Symbol*& Name = Bound[F.FormSlots[Leaf]];
+      if (Name == NULL)
+	Name = &*I;
+      else if (*Name != *I)
+	return false;
+    }
+    NameListType SemDefs;
+    for (unsigned I = 0, E = F.SemSlots.size(); I != E; ++I)
+      SemDefs.push_back(*Bound[F.SemSlots[I]]);
+    Defs->swap(SemDefs);
+    return true;
+  }
+
+  // Bidirectional search: tries to transform Expression into the backward
+  // forms of instruction semantics, replacing Result when an
+  // implementation cheaper than it is found. Forward and backward
+  // transformations are limited separately, by MaxDepth and by
+  // BACKWARD_DEPTH, so solutions are found with a lower maximum depth.
+  void Search::TransformToBackwardForms(const Tree* Expression,
+					const SearchRestrictions* ST,
+					CostType Bound, SearchResult*& Result) {
+    const BackwardFormList& Close =
+      getCloseBackwardForms(PrimaryOperatorType(Expression));
+    for (BackwardFormList::const_iterator I = Close.begin(), E = Close.end();
 	 I != E; ++I)
       {
-	if (EqualTypes(PrimaryOperatorType(I->LHS), ExpPO) &&
-	    EqualTypes(PrimaryOperatorType(I->RHS), InstrPO))
-	  return true;
-	if (I->Equivalence && EqualTypes(PrimaryOperatorType(I->RHS), ExpPO)
-	    && EqualTypes(PrimaryOperatorType(I->LHS), InstrPO))
-	  return true;
+	const Instruction* Insn = I->Insn;
+	const CostType Incumbent = Result->Cost < Bound? Result->Cost : Bound;
+	if (Insn->getCost() > Incumbent) {
+	  if (Bound < Result->Cost)
+	    ++BudgetCuts;
+	  break;
+	}
+	SearchResult* CandidateSolution =
+	  TransformExpression(Expression, I->Form, 0, ST,
+			      Incumbent - Insn->getCost());
+	// Operands were defined for the leaves of the form, which the
+	// rules leading back to the semantic may reorder or repeat
+	if (CandidateSolution->Cost == INT_MAX ||
+	    !MapBackwardFormOperands(*I, CandidateSolution)) {
+	  delete CandidateSolution;
+	  continue;
+	}
+	CandidateSolution->Cost += Insn->getCost();
+	CandidateSolution->Instructions->push_back(std::make_pair(Insn,
+								  I->Sem));
+	// Rules leading back to the semantic are applied last. They
+	// introduce no operand transformation.
+	CandidateSolution->RulesApplied->insert
+	  (CandidateSolution->RulesApplied->begin(), I->Rules.rbegin(),
+	   I->Rules.rend());
+	CandidateSolution->OpTrans->insert(CandidateSolution->OpTrans->begin(),
+					   I->Rules.size(),
+					   OperandTransformationList());
+	// Ties are left to the forward search
+	if (CandidateSolution->Cost < Result->Cost) {
+	  delete Result;
+	  Result = CandidateSolution;
+	} else
+	  delete CandidateSolution;
       }
-    return false;
+  }
+
+  // Cost already accumulated by a partial result
+  inline CostType SpentCost(const SearchResult* R) {
+    return R->Cost == INT_MAX? 0 : R->Cost;
   }
 
   // Auxiliary function used to integrate the results of a recursive
@@ -777,10 +1872,10 @@ namespace backendgen {
 				      *(Source->RulesApplied));    
     Destination->OpTrans->splice(Destination->OpTrans->begin(),
 				 *(Source->OpTrans));    
-    Destination->ST->getVR()->splice(Destination->ST->getVR()->begin(),
-				     *(Source->ST->getVR()));
-    Destination->ST->getVC()->splice(Destination->ST->getVC()->begin(),
-				     *(Source->ST->getVC()));
+    Destination->ST->getVR()->merge(*(Source->ST->getVR()));
+    Source->ST->getVR()->clear();
+    Destination->ST->getVC()->merge(*(Source->ST->getVC()));
+    Source->ST->getVC()->clear();
 
     // Now merge cost
 
@@ -830,7 +1925,8 @@ namespace backendgen {
 					       const Tree* Goal,
 					       Tree *& MatchedGoal,
 					       unsigned CurDepth,
-					       const SearchRestrictions *ST)
+					       const SearchRestrictions *ST,
+					       CostType Budget)
   {
     if (!R->Decomposition && !R->Composition)
       return NULL;
@@ -838,11 +1934,33 @@ namespace backendgen {
     std::list<Tree*>* DecomposeList = R->Decompose(Expression);
     if (DecomposeList == NULL)
       return NULL;
+    ++Stats.Decompositions;
 
-    SearchResult* CandidateSolution = new SearchResult();
+    SearchResult* CandidateSolution = NewResult();
     if (ST != NULL)
       CandidateSolution->ST->MergeVRList(ST->getVR());
 
+#ifdef PARALLEL_SEARCH
+    // Each child needs at least one instruction
+    const CostType N = DecomposeList->size();
+    if (Goal == NULL && N > 1 && Budget / N >= MinInsnCost) {
+      std::vector<const Tree*> Goals(DecomposeList->rbegin(),
+				     DecomposeList->rend());
+      SubgoalsOutcome Outcome =
+	SolveSubgoals(Goals, NULL, CurDepth + 1, CandidateSolution,
+		      Budget - (N - 1) * MinInsnCost, Budget);
+      if (Outcome != SubgoalsSerial) {
+	DeleteDecomposeList(DecomposeList);
+	if (Outcome == SubgoalsSolved) {
+	  ++Stats.DecompositionSuccesses;
+	  return CandidateSolution;
+	}
+	delete CandidateSolution;
+	return NULL;
+      }
+    }
+#endif
+
     for (std::list<Tree*>::reverse_iterator I = DecomposeList->rbegin(),
 	   E = DecomposeList->rend(); I != E; ++I)
       {
@@ -850,21 +1968,33 @@ namespace backendgen {
 	// XXX: Need a better checking of goal! Sometimes a wrong tree
 	// will be matched as goal and all is lost!
 	if (Goal != NULL) {
-	  SearchRestrictions *STnew = new SearchRestrictions();
-	  STnew->MergeVRList(CandidateSolution->ST->getVR());
-	  if (Compare<true>(Goal, *I, STnew) == true
-	      && !STnew->HasConflictingDefinitions(CandidateSolution->ST) 
+	  // The match sees the bindings of CandidateSolution through
+	  // Scratch, which only keeps the new ones, so a failed trial
+	  // copies and allocates nothing
+	  Scratch.Clear();
+	  Scratch.LayerOn(CandidateSolution->ST);
+	  ++Stats.Compares;
+	  if (Compare<true>(Goal, *I, &Scratch) == true
+	      && !Scratch.HasConflictingDefinitions(CandidateSolution->ST) 
 	      && MatchedGoal == NULL) {	    
-	    delete CandidateSolution->ST;
-	    CandidateSolution->ST = STnew;
+	    CandidateSolution->ST->Merge(&Scratch);
+	    Scratch.Clear();
 	    MatchedGoal = (*I)->clone();
 	    continue;
-	  } else {
-	    delete STnew;
 	  }
+	  Scratch.Clear();
+	}
+	// Each child needs at least one instruction
+	const CostType Spent = SpentCost(CandidateSolution);
+	if (Spent > Budget || Budget - Spent < MinInsnCost) {
+	  ++BudgetCuts;
+	  delete CandidateSolution;
+	  DeleteDecomposeList(DecomposeList);
+	  return NULL;
 	}
 	SearchResult* ChildResult = (*this)(*I, CurDepth + 1, 
-					    CandidateSolution->ST);
+					    CandidateSolution->ST,
+					    Budget - Spent);
 	// Failed to find an implementatin for this child?
 	if (ChildResult == NULL || ChildResult->Cost == INT_MAX) {
 	  delete CandidateSolution;	  
@@ -879,6 +2009,7 @@ namespace backendgen {
       }
 	
     DeleteDecomposeList(DecomposeList);
+    ++Stats.DecompositionSuccesses;
 
     return CandidateSolution;
   }
@@ -892,40 +2023,69 @@ namespace backendgen {
 				      const Tree* InsnSemantic,
 				      SearchResult* Result,
 				      unsigned CurDepth,
-				      const SearchRestrictions *ST) {    
+				      const SearchRestrictions *ST,
+				      CostType Budget) {    
     // First check the top level node
-    SearchRestrictions *STnew = new SearchRestrictions();
-    if (!(Compare<true>(Transformed, InsnSemantic, STnew) &&
-        !ST->HasConflictingDefinitions(STnew))) {
-      delete STnew;
+    ++Stats.Compares;
+    if (!(Compare<true>(Transformed, InsnSemantic, &Scratch) &&
+        !Scratch.HasConflictingDefinitions(ST))) {
+      Scratch.Clear();
       return false;
     }
     
     // Transformation revealed that these expressions match directly
     if (Transformed->isOperand()) {
       Result->Cost = 0;
-      delete Result->ST;
-      Result->ST = STnew;
+      Result->ST->Swap(Scratch);
+      Scratch.Clear();
       UpdateCurrentOperandDefinition(Result, 
 				     ExtractLeafsNames(Transformed,
-						       STnew->getVR()));
+						       Result->ST->getVR()));
       return true;
     }
-    delete STnew;
+    Scratch.Clear();
 
     // Now check for guarded assignments before delving into each children
     // of this operator
-    SearchResult* TempResults = new SearchResult();
+    SearchResult* TempResults = NewResult();
     
     // Now for every operator, prove their children equal
-    const Operator* O = dynamic_cast<const Operator*>(Transformed);
-    const Operator* OIns = dynamic_cast<const Operator*>(InsnSemantic);
+    const Operator* O = static_cast<const Operator*>(Transformed);
+    const Operator* OIns = static_cast<const Operator*>(InsnSemantic);
     TempResults->ST->Merge(ST);
+#ifdef PARALLEL_SEARCH
+    std::vector<const Tree*> Goals, Targets;
+    for (int I = 0, E = O->getArity(); I != E; ++I) {
+      Goals.push_back((*O)[I]);
+      Targets.push_back((*OIns)[I]);
+    }
+    SubgoalsOutcome Outcome = SolveSubgoals(Goals, &Targets, CurDepth + 1,
+					    TempResults, Budget, Budget);
+    if (Outcome == SubgoalsFailed) {
+      DbgIndent(CurDepth);
+      DbgPrint("Recursive call failed\n");
+      delete TempResults;
+      return false;
+    }
+    if (Outcome == SubgoalsSolved) {
+      MergeSearchResults(Result, TempResults);
+      delete TempResults;
+      return true;
+    }
+#endif
     for (int I = 0, E = O->getArity(); I != E; ++I) 
       {
+	const CostType Spent = SpentCost(TempResults);
+	if (Spent > Budget) {
+	  DbgIndent(CurDepth);
+	  DbgPrint("Cost bound exceeded\n");
+	  ++BudgetCuts;
+	  delete TempResults;
+	  return false;
+	}
 	SearchResult* SRChild = 
 	  TransformExpression((*O)[I], (*OIns)[I], CurDepth+1,
-			      TempResults->ST);
+			      TempResults->ST, Budget - Spent);
 	
 	// Failed
 	if (SRChild->Cost == INT_MAX) {
@@ -954,7 +2114,8 @@ namespace backendgen {
   SearchResult* Search::TransformExpression(const Tree* Expression,
 					    const Tree* InsnSemantic,
 					    unsigned CurDepth, 
-					    const SearchRestrictions *ST)
+					    const SearchRestrictions *ST,
+					    CostType Budget)
   {   
     //DbgIndent(CurDepth);
     Dbg(for (unsigned i = 0; i < CurDepth; ++i) std::cerr << "*";);
@@ -964,23 +2125,40 @@ namespace backendgen {
     Dbg(InsnSemantic->print(std::cerr));
     DbgPrint("\n\n");
 
-    SearchResult* Result = new SearchResult();
+    SearchResult* Result = NewResult();
+    CountNode(CurDepth);
 
     // Cancel this trial if it has exceeded maximum recursive depth allowed
     if (CurDepth == MaxDepth) {
       DbgIndent(CurDepth);
       DbgPrint("Maximum recursive depth reached.\n");
+      ++Cutoffs;
       return Result;
     }
+    if (OutOfBudget()) {
+      DbgIndent(CurDepth);
+      DbgPrint("Search budget exhausted.\n");
+      return Result;
+    }
+    const unsigned CutoffsBefore = Cutoffs;
+    const unsigned BudgetCutsBefore = BudgetCuts;
 
 #ifdef USETRANSCACHE
     // Check Transformation Cache to see if transforming Expression
     // into InsnSemantic is a dead end
-    if (TransCache.LookUp(Expression, InsnSemantic, MaxDepth-CurDepth)) {
+    bool Bounded, Budgeted;
+    if (TransCache.LookUp(Expression, InsnSemantic, MaxDepth-CurDepth,
+			  Budget, Bounded, Budgeted)) {
       DbgIndent(CurDepth);
       DbgPrint("Cache informs us there is no such transformation.\n");
+      if (Bounded)
+	++Cutoffs;
+      if (Budgeted)
+	++BudgetCuts;
+      ++Stats.CacheHits;
       return Result;
     }
+    ++Stats.CacheMisses;
 #endif
 
 #ifndef EXTENSIVESEARCH
@@ -995,20 +2173,20 @@ namespace backendgen {
 #endif
 
     // See if we already have a match
-    SearchRestrictions *STnew = new SearchRestrictions();
-    if (Compare<false>(Expression, InsnSemantic, STnew) == true &&
-	!ST->HasConflictingDefinitions(STnew)) {
+    ++Stats.Compares;
+    if (Compare<false>(Expression, InsnSemantic, &Scratch) == true &&
+	!Scratch.HasConflictingDefinitions(ST)) {
       DbgIndent(CurDepth);
       DbgPrint("Already matches!\n");
       Result->Cost = 0;
-      delete Result->ST;
-      Result->ST = STnew;
+      Result->ST->Swap(Scratch);
+      Scratch.Clear();
       UpdateCurrentOperandDefinition(Result, 
 				     ExtractLeafsNames(Expression,
-						       STnew->getVR()));
+						       Result->ST->getVR()));
       return Result;
     }      
-    delete STnew;
+    Scratch.Clear();
 
     DbgIndent(CurDepth);
     DbgPrint("Trying to transform children without applying any rule");   
@@ -1016,8 +2194,8 @@ namespace backendgen {
 
     // See if we obtain success without applying a transformation
     // at this level
-    if (TransformExpressionAux(Expression, InsnSemantic, Result, CurDepth, ST) 
-	== true)      	
+    if (TransformExpressionAux(Expression, InsnSemantic, Result, CurDepth, ST,
+			       Budget) == true)      	
 	return Result;
       
     DbgIndent(CurDepth);
@@ -1026,36 +2204,58 @@ namespace backendgen {
     // Try to apply transformations that bring Expression
     // closer to this instruction (specifically, to this
     // fragment of instruction), node by node.
-    for (RuleIterator I = RulesMgr.getBegin(), E = RulesMgr.getEnd();
-	 I != E; ++I)
+    // Only rules found by the rule index may match
+    RuleCandidateList Candidates;
+    RulesMgr.getCandidates(Expression, Candidates);
+    for (RuleCandidateList::const_iterator C = Candidates.begin(),
+	   CE = Candidates.end(); C != CE; ++C)
       {
+	const Rule* I = C->R;
 	bool Forward = true;
+	// Other tasks may have found a cheaper implementation meanwhile.
+	// Only the task's own transformation has spent nothing so far.
+	if (CurDepth == 0)
+	  ApplySharedBound(Budget);
 	// See if makes sense applying this rule
 #ifndef EXTENSIVESEARCH	
-	if (!I->ForwardMatch(Expression) || 
+	if (!C->Forward || !I->ForwardMatch(Expression) || 
 	    !EqualTypes(PrimaryOperatorType(I->RHS),
 			PrimaryOperatorType(InsnSemantic))) 
 	  {
-	    if (!I->BackwardMatch(Expression) || 
+	    if (!C->Backward || !I->BackwardMatch(Expression) || 
 		!EqualTypes(PrimaryOperatorType(I->LHS), 
 			    PrimaryOperatorType(InsnSemantic)))
 	      continue;
 	    Forward = false;
 	  }
 #else
-	if (!I->ForwardMatch(Expression)) 
+	if (!C->Forward || !I->ForwardMatch(Expression)) 
 	  {
-	    if (!I->BackwardMatch(Expression))
+	    if (!C->Backward || !I->BackwardMatch(Expression))
 	      continue;
 	    Forward = false;
 	  }
 #endif
 
+	CountRuleAttempt(I->RuleID);
+
 	// Case analysis 1: Suppose this rule does not decompose the
 	// tree
 	if ((!Forward || !I->Decomposition) &&
 	    (Forward || !I->Composition)) {       
 
+#ifndef EXTENSIVESEARCH
+	  // The transformed tree must match our goal at the top level node.
+	  // Most rules fail this, so check it before building the tree.
+	  const Tree* Root = Forward? I->ForwardApplyRoot() :
+	    I->BackwardApplyRoot();
+	  if (Root != NULL) {
+	    ++Stats.Compares;
+	    if (!Compare<true>(Root, InsnSemantic, NULL))
+	      continue;
+	  }
+#endif
+
 	  DbgIndent(CurDepth);
 	  DbgPrint("Applying non-decomposing rule:\n  ");
 	  DbgIndent(CurDepth);
@@ -1074,12 +2274,14 @@ namespace backendgen {
 	  // transformations because of a call to TransformExpressionAux 
 	  // early in this function.
 	  SearchResult* SRChild = 
-	    TransformExpression(Transformed, InsnSemantic, CurDepth+1, ST);
+	    TransformExpression(Transformed, InsnSemantic, CurDepth+1, ST,
+				Budget);
 	  // If success
 	  if (SRChild != NULL && SRChild->Cost != INT_MAX) {
 	    delete Result;
 	    Result = SRChild;
 	    Result->RulesApplied->push_back(I->RuleID);
+	    ++Stats.RuleSuccesses[I->RuleID];
 	    if (Forward)
 	      Result->OpTrans
 		->push_back(I->ForwardApplyGetOpTrans(Expression));
@@ -1098,9 +2300,10 @@ namespace backendgen {
 	  // This may involve recursive calls to this function (to transform
 	  // and adapt the children nodes).
 	  if (TransformExpressionAux(Transformed, InsnSemantic, Result, 
-				     CurDepth, ST) == true)
+				     CurDepth, ST, Budget) == true)
 	    {	      
 	      Result->RulesApplied->push_back(I->RuleID);
+	      ++Stats.RuleSuccesses[I->RuleID];
 	      if (Forward)
 		Result->OpTrans
 		  ->push_back(I->ForwardApplyGetOpTrans(Expression));
@@ -1124,7 +2327,7 @@ namespace backendgen {
 	Tree* Transformed = NULL;
 	SearchResult* ChildResult = 
 	  ApplyDecompositionRule(&*I, Expression, InsnSemantic, Transformed,
-				 CurDepth, ST);
+				 CurDepth, ST, Budget);
 	
 	//Failed
 	if (ChildResult == NULL || ChildResult->Cost == INT_MAX) {	  
@@ -1133,6 +2336,14 @@ namespace backendgen {
 	  continue;
 	}
 	
+	// Too expensive already
+	if (ChildResult->Cost > Budget) {
+	  ++BudgetCuts;
+	  delete ChildResult;
+	  delete Transformed;
+	  continue;
+	}
+
 	ChildResult->ST->Merge(ST);
 	
 	// Now we decomposed and have a implementation of the remaining
@@ -1143,7 +2354,8 @@ namespace backendgen {
 	// This may involve recursive calls to this function (to transform
 	// and adapt the children nodes).
 	if (TransformExpressionAux(Transformed, InsnSemantic, Result,
-				   CurDepth, ChildResult->ST) == true)
+				   CurDepth, ChildResult->ST,
+				   Budget - ChildResult->Cost) == true)
 	  {
 	    DbgIndent(CurDepth);
 	    DbgPrint("Decomposition was successful\n");	    
@@ -1151,6 +2363,7 @@ namespace backendgen {
 	    delete ChildResult;
 	    delete Transformed;
 	    Result->RulesApplied->push_back(I->RuleID);
+	    ++Stats.RuleSuccesses[I->RuleID];
 	    if (Forward)
 		Result->OpTrans
 		  ->push_back(I->ForwardApplyGetOpTrans(Expression));
@@ -1163,82 +2376,489 @@ namespace backendgen {
 	DbgPrint("Failed to match decomposed tree with our requisites\n");	
 	delete ChildResult;
 	delete Transformed;			    			 
-      } // end for(RuleIterator)
+      } // end for(RuleCandidateList)
 
     DbgIndent(CurDepth);
     DbgPrint("Fail to prove both expressions are equivalent.\n");
 
 #ifdef USETRANSCACHE
-    TransCache.Add(Expression, InsnSemantic, MaxDepth-CurDepth);
+    // If the depth limit played no part, this holds for any depth. The
+    // same goes for the cost bound.
+    if (!isStopped())
+      TransCache.Add(Expression, InsnSemantic, Cutoffs == CutoffsBefore?
+		     UNBOUNDED_DEPTH : MaxDepth-CurDepth,
+		     BudgetCuts == BudgetCutsBefore? INT_MAX : Budget);
 #endif
 
     // We tried but could not find anything
     return Result;
   }
   
+  // A pending best-first attempt: implementing the searched expression
+  // with Candidate, exploring up to Depth levels
+  struct SearchAttempt {
+    // Lower bound of the cost of any implementation using Candidate
+    CostType Bound;
+    // Rule applications needed to bring expression and candidate primary
+    // operators together
+    unsigned Distance;
+    unsigned Depth;
+    const SemanticCandidate* Candidate;
+  };
+
+  // Our binary predicate ordering the attempts queue: cheapest bound
+  // first, then shallowest, then closest, then instruction order
+  class AttemptsComparator {
+  public:
+    bool operator() (const SearchAttempt& A, const SearchAttempt& B) const {
+      if (A.Bound != B.Bound)
+	return A.Bound > B.Bound;
+      if (A.Depth != B.Depth)
+	return A.Depth > B.Depth;
+      if (A.Distance != B.Distance)
+	return A.Distance > B.Distance;
+      return A.Candidate->SeqNum > B.Candidate->SeqNum;
+    }
+  };
+
+  // Best-first alternative to the transformations step of operator().
+  // Each close semantic is an attempt ranked by a lower bound of its cost:
+  // the semantic instruction cost, as rules are free and may erase
+  // operators. The operator distance given by the rules reachability sets
+  // the first depth worth trying and breaks ties. A failed attempt is
+  // queued again DepthStep levels deeper, so unlike restarting the whole
+  // search with a larger depth, only attempts that still may beat the best
+  // result found so far are deepened. Search stops when no attempt left
+  // has a bound lower than the best cost.
+  SearchResult* Search::BestFirstTransform(const Tree* Expression,
+					   const SearchRestrictions* ST,
+					   CostType Bound)
+  {
+    const unsigned FinalDepth = MaxDepth;
+    const unsigned PO = PrimaryOperatorType(Expression);
+    std::priority_queue<SearchAttempt, std::vector<SearchAttempt>,
+      AttemptsComparator> Open;
+    const CandidateList& Close = getCloseCandidates(PO);
+    for (CandidateList::const_iterator I = Close.begin(), E = Close.end();
+	 I != E; ++I) {
+      SearchAttempt A;
+      A.Bound = I->Insn->getCost();
+      A.Distance = RulesMgr.getDistance
+	(PO, PrimaryOperatorType(I->Sem->SemanticExpression));
+      A.Depth = A.Distance >= InitialDepth? A.Distance + 1 : InitialDepth;
+      if (A.Depth > FinalDepth)
+	A.Depth = FinalDepth;
+      A.Candidate = &*I;
+      Open.push(A);
+    }
+
+    SearchResult* Result = NewResult();
+    while (!Open.empty() && !Limits->isExhausted()) {
+      SearchAttempt A = Open.top();
+      Open.pop();
+      // No attempt left can beat the best result
+      if (Result->Cost != INT_MAX && A.Bound >= Result->Cost)
+	break;
+      if (A.Bound > Bound) {
+	++BudgetCuts;
+	break;
+      }
+      DbgPrint("Best-first attempt with depth ");
+      Dbg(std::cerr << A.Depth << "\n");
+      MaxDepth = A.Depth;
+      const unsigned CutoffsBefore = Cutoffs;
+      SearchResult* CandidateSolution =
+	TransformExpression(Expression, A.Candidate->Sem->SemanticExpression,
+			    0, ST, (Result->Cost < Bound? Result->Cost : Bound)
+			    - A.Bound);
+      if (CandidateSolution->Cost != INT_MAX) {
+	// Integrate our instruction
+	CandidateSolution->Cost += A.Candidate->Insn->getCost();
+	CandidateSolution->Instructions->push_back
+	  (std::make_pair(A.Candidate->Insn, A.Candidate->Sem));
+	if (CandidateSolution->Cost < Result->Cost) {
+	  delete Result;
+	  Result = CandidateSolution;
+	} else
+	  delete CandidateSolution;
+	continue;
+      }
+      delete CandidateSolution;
+      // Failed, try it again deeper unless depth was not the problem
+      if (A.Depth < FinalDepth && Cutoffs != CutoffsBefore) {
+	A.Depth = (A.Depth + DepthStep < FinalDepth)?
+	  A.Depth + DepthStep : FinalDepth;
+	Open.push(A);
+      }
+    }
+    MaxDepth = FinalDepth;
+    return Result;
+  }
+
+#ifdef PARALLEL_SEARCH
+  // Creates one task per candidate semantic of Expression for
+  // ParallelTransform. Each task searches with a copy of this Search (see
+  // Search(Search*)) and leaves its solution in Solutions. Best is the lowest cost
+  // found so far, shared by all tasks: it bounds the tasks that start
+  // later, and those whose instruction alone costs more are dropped.
+  // Running tasks read it too (see SharedBound), so they tighten their
+  // budget and stop once they can no longer match it.
+  void Search::SpawnCandidateTasks(const Tree* Expression,
+				   const SearchRestrictions* ST,
+				   CostType Bound,
+				   std::vector<SearchResult*>& Solutions,
+				   CostType& Best, unsigned& TaskCutoffs,
+				   unsigned& TaskBudgetCuts,
+				   SearchStats& TaskStats)
+  {
+    const CandidateList& Close =
+      getCloseCandidates(PrimaryOperatorType(Expression));
+    for (unsigned I = 0, E = Close.size(); I != E; ++I) {
+#pragma omp task default(shared) firstprivate(I)
+      {
+	const SemanticCandidate& C = Close[I];
+	CostType Incumbent;
+#pragma omp critical (SearchBound)
+	Incumbent = Best;
+	if (C.Insn->getCost() > Incumbent) {
+	  if (C.Insn->getCost() > Bound) {
+#pragma omp critical (SearchBound)
+	    ++TaskBudgetCuts;
+	  }
+	} else {
+	  Search Worker(this);
+	  Worker.SharedBound = &Best;
+	  Worker.TaskCost = C.Insn->getCost();
+	  SearchResult* CandidateSolution =
+	    Worker.TransformExpression(Expression, C.Sem->SemanticExpression,
+				       0, ST, Incumbent - C.Insn->getCost());
+	  if (CandidateSolution->Cost != INT_MAX) {
+	    // Integrate our instruction
+	    CandidateSolution->Cost += C.Insn->getCost();
+	    CandidateSolution->Instructions->push_back(std::make_pair(C.Insn,
+								      C.Sem));
+	  }
+#pragma omp critical (SearchBound)
+	  {
+	    // Running tasks read Best without locking
+	    if (CandidateSolution->Cost < Best) {
+#pragma omp atomic write
+	      Best = CandidateSolution->Cost;
+	    }
+	    TaskCutoffs += Worker.Cutoffs;
+	    TaskBudgetCuts += Worker.BudgetCuts;
+	    TaskStats.Merge(Worker.Stats);
+	  }
+	  Solutions[I] = CandidateSolution;
+	}
+	// The pools of this thread are not trimmed by the top level search
+	TrimSearchPools();
+      }
+    }
+#pragma omp taskwait
+  }
+
+  // AND-parallel solving of the children of a node. Goals[I] is
+  // transformed into (*Targets)[I] or, if Targets is NULL, searched for
+  // an implementation. Each goal is solved by a task with a copy of this
+  // Search (see Search(Search*)), starting from the restrictions of Partial and with a
+  // budget of ChildBudget. This is only done when goals share no operand
+  // names and other threads may help; otherwise SubgoalsSerial is
+  // returned and nothing is done. Once all tasks joined, their results
+  // are merged into Partial in order, as the serial loops do. If they
+  // conflict with Partial or with each other, or together exceed Budget,
+  // SubgoalsSerial is returned as well, as a serial search may still
+  // succeed with tighter budgets.
+  Search::SubgoalsOutcome
+  Search::SolveSubgoals(const std::vector<const Tree*>& Goals,
+			const std::vector<const Tree*>* Targets,
+			unsigned CurDepth, SearchResult* Partial,
+			CostType ChildBudget, CostType Budget)
+  {
+    if (CurDepth > AND_PARALLEL_DEPTH || Goals.size() < 2 ||
+	!omp_in_parallel())
+      return SubgoalsSerial;
+    std::set<std::string> Seen;
+    for (unsigned I = 0, E = Goals.size(); I != E; ++I) {
+      std::set<std::string> Names;
+      CollectOperandNames(Goals[I], Names);
+      if (Targets != NULL)
+	CollectOperandNames((*Targets)[I], Names);
+      for (std::set<std::string>::const_iterator N = Names.begin(),
+	     NE = Names.end(); N != NE; ++N)
+	if (!Seen.insert(*N).second)
+	  return SubgoalsSerial;
+    }
+
+    const SearchRestrictions* ST = Partial->ST;
+    std::vector<SearchResult*> Children(Goals.size(),
+					static_cast<SearchResult*>(NULL));
+    unsigned TaskCutoffs = 0, TaskBudgetCuts = 0;
+    SearchStats TaskStats;
+    for (unsigned I = 0, E = Goals.size(); I != E; ++I) {
+#pragma omp task default(shared) firstprivate(I)
+      {
+	Search Worker(this);
+	Children[I] = Targets != NULL?
+	  Worker.TransformExpression(Goals[I], (*Targets)[I], CurDepth, ST,
+				     ChildBudget) :
+	  Worker(Goals[I], CurDepth, ST, ChildBudget);
+#pragma omp critical (SearchBound)
+	{
+	  TaskCutoffs += Worker.Cutoffs;
+	  TaskBudgetCuts += Worker.BudgetCuts;
+	  TaskStats.Merge(Worker.Stats);
+	}
+	TrimSearchPools();
+      }
+    }
+#pragma omp taskwait
+    Cutoffs += TaskCutoffs;
+    BudgetCuts += TaskBudgetCuts;
+    Stats.Merge(TaskStats);
+
+    // Children were solved apart, so a name bound by several of them,
+    // e.g. an operand made up by a rule, may be bound differently by
+    // each. Every child is checked against Partial and against the
+    // children accepted before it.
+    SubgoalsOutcome Outcome = SubgoalsSolved;
+    CostType Total = 0;
+    SearchRestrictions Accepted;
+    for (unsigned I = 0, E = Children.size(); I != E; ++I) {
+      if (Children[I] == NULL || Children[I]->Cost == INT_MAX)
+	Outcome = SubgoalsFailed;
+      else if (Outcome == SubgoalsSolved &&
+	       (Partial->ST->HasConflictingDefinitions(Children[I]->ST) ||
+		Accepted.HasConflictingDefinitions(Children[I]->ST) ||
+		(Total += Children[I]->Cost) > Budget))
+	Outcome = SubgoalsSerial;
+      else if (Outcome == SubgoalsSolved)
+	Accepted.Merge(Children[I]->ST);
+    }
+    for (unsigned I = 0, E = Children.size(); I != E; ++I) {
+      if (Outcome == SubgoalsSolved)
+	MergeSearchResults(Partial, Children[I]);
+      delete Children[I];
+    }
+    return Outcome;
+  }
+
+  // OR-parallel version of the transformations step of operator(): every
+  // candidate semantic is tried by its own task. Outside a parallel region
+  // a team is started for them, otherwise idle threads of the current
+  // team (e.g. those done with their patterns) pick them up. Solutions are
+  // merged in candidate order, with the same preference as the serial
+  // loop.
+  SearchResult* Search::ParallelTransform(const Tree* Expression,
+					  const SearchRestrictions* ST,
+					  CostType Bound)
+  {
+    const CandidateList& Close =
+      getCloseCandidates(PrimaryOperatorType(Expression));
+    std::vector<SearchResult*> Solutions(Close.size(),
+					 static_cast<SearchResult*>(NULL));
+    CostType Best = Bound;
+    unsigned TaskCutoffs = 0, TaskBudgetCuts = 0;
+    SearchStats TaskStats;
+    if (omp_in_parallel()) {
+      SpawnCandidateTasks(Expression, ST, Bound, Solutions, Best,
+			  TaskCutoffs, TaskBudgetCuts, TaskStats);
+    } else {
+#pragma omp parallel
+#pragma omp single
+      SpawnCandidateTasks(Expression, ST, Bound, Solutions, Best,
+			  TaskCutoffs, TaskBudgetCuts, TaskStats);
+    }
+    Cutoffs += TaskCutoffs;
+    BudgetCuts += TaskBudgetCuts;
+    Stats.Merge(TaskStats);
+
+    SearchResult* Result = NewResult();
+    for (unsigned I = 0, E = Solutions.size(); I != E; ++I) {
+      if (Solutions[I] != NULL && Solutions[I]->Cost != INT_MAX &&
+	  Solutions[I]->Cost <= Result->Cost) {
+	delete Result;
+	Result = Solutions[I];
+      } else
+	delete Solutions[I];
+    }
+    return Result;
+  }
+#endif
+
+  // Searches the cheapest form of Expression found by equality saturation,
+  // or Expression itself if its form has no implementation, both depth
+  // first. Successive searches of the same expression, with increasing
+  // depths, saturate it only once.
+  SearchResult* Search::SaturatedSearch(const Tree* Expression,
+					const SearchRestrictions* ST,
+					CostType Bound) {
+    const Tree* Source = NodeFactory::Instance().intern(Expression);
+    if (Source != SaturatedSource) {
+      EGraph Graph(RulesMgr, InstructionsMgr);
+      const unsigned Root = Graph.AddExpression(Expression);
+      Graph.Saturate(EGRAPH_NODES, EGRAPH_ROUNDS);
+      SaturatedRules.clear();
+      Tree* Form = Graph.Extract(Root, SaturatedRules);
+      SaturatedSource = Source;
+      SaturatedForm = NodeFactory::Instance().intern(Form);
+      if (!Form->isShared())
+	delete Form;
+    }
+    SearchResult* Result =
+      SearchExpression(SaturatedForm, 0, ST, Bound, DepthFirstStrategy);
+    if (Result->Cost != INT_MAX) {
+      // Rules used by saturation are only listed, ahead of the ones the
+      // search applied: they are not a sequence that rewrites Expression
+      // into SaturatedForm (see EGraph::Extract), and RulesApplied is not
+      // replayed. Their OpTrans lists are empty because the e-graph only
+      // uses rules without operand transformations that introduce no
+      // operand (see EGraph::EGraph). Operands of SaturatedForm are those
+      // of Expression and are bound by name as usual.
+      Result->RulesApplied->insert(Result->RulesApplied->end(),
+				   SaturatedRules.begin(),
+				   SaturatedRules.end());
+      Result->OpTrans->insert(Result->OpTrans->end(), SaturatedRules.size(),
+			      OperandTransformationList());
+    } else if (SaturatedForm != Source) {
+      delete Result;
+      Result = SearchExpression(Expression, 0, ST, Bound, DepthFirstStrategy);
+    }
+    return Result;
+  }
+
   // This operator overload effectively starts the search
   // VR is a mapping with current bindings of virtual registers (operand names)
   // to real registers, so we need to avoid redefinitions when searching
   // for an implementation of Expression.
+  // A search with CurDepth 0 is timed and counts its cutoffs, for
+  // getStatus, as a whole, even if it searches several expressions.
   SearchResult* Search::operator() (const Tree* Expression, unsigned CurDepth,
-				    const SearchRestrictions *ST)
+				    const SearchRestrictions *ST,
+				    CostType Bound)
+  {
+    if (CurDepth != 0)
+      return SearchExpression(Expression, CurDepth, ST, Bound, Strategy);
+
+    const double StartTime = WallTime();
+    StartCutoffs = Cutoffs;
+    if (!CloseSets->Built)
+      BuildCloseSets();
+    SearchResult* Result = Strategy == EGraphStrategy?
+      SaturatedSearch(Expression, ST, Bound) :
+      SearchExpression(Expression, 0, ST, Bound, Strategy);
+#ifdef DEBUG_SEARCH_RESULTS
+    if (Result->Cost != INT_MAX)
+      Result->DumpResults(std::cerr);
+#endif
+    Stats.DepthTimes[MaxDepth] += WallTime() - StartTime;
+    TrimSearchPools();
+    return Result;
+  }
+
+  // Search of operator(), with TopStrategy deciding how the candidates of
+  // a search with CurDepth 0 are tried
+  SearchResult* Search::SearchExpression(const Tree* Expression,
+					 unsigned CurDepth,
+					 const SearchRestrictions *ST,
+					 CostType Bound,
+					 SearchStrategy TopStrategy)
   {
     DbgIndent(CurDepth);
     DbgPrint("Search started on ");
     Dbg(Expression->print(std::cerr));
     DbgPrint("\n");
 
-    SearchResult* Result = new SearchResult();
+    SearchResult* Result = NewResult();
+    CountNode(CurDepth);
 
     // Cancel this trial if it has exceeded maximum recursive depth allowed
     if (CurDepth == MaxDepth) {
       DbgIndent(CurDepth);
       DbgPrint("Maximum recursive depth reached.\n");
+      ++Cutoffs;
+      return Result;
+    }
+
+    // Cancel it as well if the budget ran out
+    if (OutOfBudget()) {
+      DbgIndent(CurDepth);
+      DbgPrint("Search budget exhausted.\n");
       return Result;
     }
 
+    // Not even the cheapest instruction fits
+    if (Bound < MinInsnCost) {
+      DbgIndent(CurDepth);
+      DbgPrint("Cost bound exceeded.\n");
+      ++BudgetCuts;
+      return Result;
+    }
+
+#ifdef USESEARCHMEMO
+    const unsigned CutoffsBefore = Cutoffs;
+    const unsigned BudgetCutsBefore = BudgetCuts;
+    // See if an equivalent search was already solved
+    NameListType MemoNames;
+    const std::string MemoKey =
+      SearchMemo::BuildKey(Expression, ST, MemoNames);
+    bool Bounded;
+    SearchResult* Memoized = Memo.LookUp(MemoKey, MaxDepth - CurDepth,
+					 MemoNames, ST, Bounded, Stats);
+    if (Memoized != NULL) {
+      DbgIndent(CurDepth);
+      DbgPrint("Memoized search result\n");
+      ++Stats.MemoHits;
+      if (Bounded)
+	++Cutoffs;
+      delete Result;
+      return Memoized;
+    }
+    ++Stats.MemoMisses;
+#endif
+
     DbgIndent(CurDepth);
     DbgPrint("Trying direct match\n");
     // First, see if this expression is directly computable by
-    // an available instruction, or part of this instruction    
-    for (InstrIterator I = InstructionsMgr.getBegin(), 
-	   E = InstructionsMgr.getEnd(); I != E; ++I) 
+    // an available instruction, or part of this instruction.
+    // Only semantics with the same key as the expression may match.
+    const CandidateList& Direct =
+      InstructionsMgr.getCandidates(InstrManager::getSemanticKey(Expression));
+    const Instruction* Matched = NULL;
+    for (CandidateList::const_iterator I = Direct.begin(), E = Direct.end();
+	 I != E; ++I)
       {
-        // compare each semantic expression
-	for (SemanticIterator I2 = (*I)->getBegin(), 
-	       E2 = (*I)->getEnd(); I2 != E2; ++I2)
+	// Only the first matching semantic of an instruction is considered
+	if (I->Insn == Matched)
+	  continue;
+	++Stats.Compares;
+	if (Compare<false>(Expression, I->Sem->SemanticExpression,
+			   &Scratch) && 
+	    !Scratch.HasConflictingDefinitions(ST) &&
+	    Result->Cost >= I->Insn->getCost())
 	  {
-	    SearchRestrictions* STnew = new SearchRestrictions();
-	    if (Compare<false>(Expression, I2->SemanticExpression,
-			       STnew) && 
-		!STnew->HasConflictingDefinitions(ST) &&
-		Result->Cost >= (*I)->getCost())
-	      {
-		delete Result;		
-		Result = new SearchResult();
-		Result->Cost = (*I)->getCost();
-		Result->Instructions->push_back(std::make_pair(*I,I2));
-		delete Result->ST;
-		Result->ST = STnew;
-		UpdateCurrentOperandDefinition(Result, 
-					       ExtractLeafsNames
-					       (Expression,
-						STnew->getVR()));
-		break;
-	      } else {
-	      delete STnew;
-	    }
+	    delete Result;		
+	    Result = NewResult();
+	    Result->Cost = I->Insn->getCost();
+	    Result->Instructions->push_back(std::make_pair(I->Insn,I->Sem));
+	    Result->ST->Swap(Scratch);
+	    UpdateCurrentOperandDefinition(Result, 
+					   ExtractLeafsNames
+					   (Expression,
+					    Result->ST->getVR()));
+	    Matched = I->Insn;
 	  }
+	Scratch.Clear();
       }
 
     // If found something, return it
     if (Result->Cost != INT_MAX) {
       DbgIndent(CurDepth);
       DbgPrint("Direct match successful\n");
-#ifdef DEBUG_SEARCH_RESULTS
-      if (CurDepth == 0) {
-	Result->DumpResults(std::cerr);
-      }
+#ifdef USESEARCHMEMO
+      if (BudgetCuts == BudgetCutsBefore && !isStopped())
+	Memo.Add(MemoKey, MaxDepth - CurDepth, Cutoffs != CutoffsBefore,
+		 MemoNames, Result, ST, Stats);
 #endif
       return Result;
     }
@@ -1256,7 +2876,8 @@ namespace backendgen {
 	SearchResult* CandidateSolution = ApplyDecompositionRule(&*I, 
 								 Expression,
 								 NULL, dummy,
-								 CurDepth, ST);
+								 CurDepth, ST,
+								 Bound);
 
 	if (CandidateSolution == NULL)
 	  continue;
@@ -1286,48 +2907,69 @@ namespace backendgen {
     // expression. The instruction must match expression's top
     // operator, or there exists a transformation that makes this
     // matching feasible.
-    for (InstrIterator I = InstructionsMgr.getBegin(), 
-	   E = InstructionsMgr.getEnd(); I != E; ++I) 
-      {
-	for (SemanticIterator I1 = (*I)->getBegin(), E1 = (*I)->getEnd();
-	     I1 != E1; ++I1)
-	  {
-	    SearchResult* CandidateSolution = 
-	      TransformExpression(Expression, I1->SemanticExpression,
-				  CurDepth, ST);
-
-	    // Failed
-	    if (CandidateSolution->Cost == INT_MAX) {
-	      delete CandidateSolution;
-	      continue;
-	    }	     
+    if (CurDepth == 0 && TopStrategy == BestFirstStrategy) {
+      delete Result;
+      Result = BestFirstTransform(Expression, ST, Bound);
+#ifdef PARALLEL_SEARCH
+    } else if (CurDepth == 0) {
+      delete Result;
+      Result = ParallelTransform(Expression, ST, Bound);
+#endif
+    } else {
+      const CandidateList& Close =
+	getCloseCandidates(PrimaryOperatorType(Expression));
+      for (CandidateList::const_iterator I = Close.begin(), E = Close.end();
+	   I != E; ++I)
+	{
+	  // Candidates come cheapest first. Once one can not match the best
+	  // implementation known, none of the others can.
+	  const CostType Incumbent = Result->Cost < Bound? Result->Cost : Bound;
+	  if (I->Insn->getCost() > Incumbent) {
+	    if (Bound < Result->Cost)
+	      ++BudgetCuts;
+	    break;
+	  }
+	  SearchResult* CandidateSolution =
+	    TransformExpression(Expression, I->Sem->SemanticExpression,
+				CurDepth, ST, Incumbent - I->Insn->getCost());
 
-	    // Integrate our instruction
-	    CandidateSolution->Cost += (*I)->getCost();
-	    CandidateSolution->Instructions->push_back(std::make_pair(*I,I1));
-	    // OperandsDefs for this insn should already be in the list
-	    // thanks to TransformExpression that decoded its operands
-	    // from the expression
-
-	    // Check if it is a good solution
-	    if (CandidateSolution->Cost <= Result->Cost)
-	      {
-		delete Result;
-		Result = CandidateSolution;		
-	      }	
-	    else
-	      delete CandidateSolution;
+	  // Failed
+	  if (CandidateSolution->Cost == INT_MAX) {
+	    delete CandidateSolution;
+	    continue;
 	  }
-      }
+
+	  // Integrate our instruction
+	  CandidateSolution->Cost += I->Insn->getCost();
+	  CandidateSolution->Instructions->push_back(std::make_pair(I->Insn,
+								    I->Sem));
+	  // OperandsDefs for this insn should already be in the list
+	  // thanks to TransformExpression that decoded its operands
+	  // from the expression
+
+	  // Check if it is a good solution
+	  if (CandidateSolution->Cost <= Result->Cost)
+	    {
+	      delete Result;
+	      Result = CandidateSolution;
+	    }
+	  else
+	    delete CandidateSolution;
+	}
+    }
+
+    // Bidirectional search meets the semantics halfway as well
+    if (CurDepth == 0 && TopStrategy == BidirectionalStrategy)
+      TransformToBackwardForms(Expression, ST, Bound, Result);
 
     // If found something, return it
     if (Result->Cost != INT_MAX) {
-#ifdef DEBUG_SEARCH_RESULTS
-      if (CurDepth == 0) {
-	Result->DumpResults(std::cerr);
-      }
+#ifdef USESEARCHMEMO
+      if (BudgetCuts == BudgetCutsBefore && !isStopped())
+	Memo.Add(MemoKey, MaxDepth - CurDepth, Cutoffs != CutoffsBefore,
+		 MemoNames, Result, ST, Stats);
 #endif
-      return Result;    
+      return Result;
     }
 
     // We can't find anything
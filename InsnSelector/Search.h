@@ -15,37 +15,140 @@
 #include "Semantic.h"
 #include "../Instruction.h"
 #include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <climits>
+#ifdef PARALLEL_SEARCH
+#include <omp.h>
+#endif
 
 // TransCache is static, so it gets used between different searches.
 // In order words, Search gets faster when it is used multiple times.
-//#define STATIC_TRANSCACHE
-// The above definition is currently controlled by Makefile
-// This option is enabled by default.
 
 // If parallel search is enabled, TemplateManager will fork multiple
-// threads to search for more than one pattern at a time. To avoid
-// data race conditions, STATIC_TRANSCACHE must be DISABLED.
+// threads to search for more than one pattern at a time. The static
+// TransCache is then shared by all threads, each of its shards being
+// guarded by its own lock.
 //#define PARALLEL_SEARCH
 // The above definition is currently controlled by Makefile
-// Use "PARALLEL_SEARCH=1 make" to activate this and disable STATIC_TRANSCACHE.
+// Use "PARALLEL_SEARCH=1 make" to activate this.
+
+// Likewise, "BEST_FIRST_SEARCH=1 make" makes pattern searches use the
+// best-first strategy (see Search::setStrategy).
 
 using namespace backendgen::expression;
 
 namespace backendgen {
 
-  typedef std::list<std::string> NameListType;
+  typedef std::list<Symbol> NameListType;
   // This list should store operands for each instruction of the sequence
   // returned by SearchResult.
   typedef std::list<NameListType*> OperandsDefsType;
-  // This list stores a mapping of virtual to real registers. This occur
+  // Small map from operand names to values, kept as a vector sorted by
+  // key symbol. A key may be bound more than once: entries with the same
+  // key are kept in order of precedence and lookups only see the first
+  // one. Checking two maps for conflicts is a merge of both vectors.
+  template <class T>
+  class RestrictionMap {
+  public:
+    typedef std::pair<Symbol, T> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+  private:
+    struct KeyLess {
+      bool operator() (const value_type& A, const value_type& B) const {
+	return A.first < B.first;
+      }
+      bool operator() (const value_type& A, const Symbol& B) const {
+	return A.first < B;
+      }
+    };
+    std::vector<value_type> Entries;
+  public:
+    iterator begin() { return Entries.begin(); }
+    iterator end() { return Entries.end(); }
+    const_iterator begin() const { return Entries.begin(); }
+    const_iterator end() const { return Entries.end(); }
+    bool empty() const { return Entries.empty(); }
+    unsigned size() const { return Entries.size(); }
+    void clear() { Entries.clear(); }
+    void swap(RestrictionMap& B) { Entries.swap(B.Entries); }
+    void erase(iterator I) { Entries.erase(I); }
+    // Adds Element after the entries bound to the same key
+    void push_back(const value_type& Element) {
+      Entries.insert(std::upper_bound(Entries.begin(), Entries.end(),
+				      Element, KeyLess()), Element);
+    }
+    // First entry bound to Key, or end()
+    iterator find(const Symbol& Key) {
+      iterator I = std::lower_bound(Entries.begin(), Entries.end(), Key,
+				    KeyLess());
+      return (I != Entries.end() && I->first == Key)? I : Entries.end();
+    }
+    const_iterator find(const Symbol& Key) const {
+      const_iterator I = std::lower_bound(Entries.begin(), Entries.end(),
+					  Key, KeyLess());
+      return (I != Entries.end() && I->first == Key)? I : Entries.end();
+    }
+    // Adds all entries of Source ahead of the ones bound to the same keys
+    void merge(const RestrictionMap& Source) {
+      if (Source.empty())
+	return;
+      std::vector<value_type> Result;
+      Result.reserve(Entries.size() + Source.Entries.size());
+      const_iterator I = Source.begin(), E = Source.end(), I2 = begin(),
+	E2 = end();
+      while (I != E && I2 != E2) {
+	if (I2->first < I->first)
+	  Result.push_back(*I2++);
+	else
+	  Result.push_back(*I++);
+      }
+      Result.insert(Result.end(), I, E);
+      Result.insert(Result.end(), I2, E2);
+      Entries.swap(Result);
+    }
+    // True if some key is bound to different values in this map and in B
+    bool conflictsWith(const RestrictionMap& B) const {
+      const_iterator I = begin(), E = end(), I2 = B.begin(), E2 = B.end();
+      while (I != E && I2 != E2) {
+	if (I->first < I2->first) {
+	  ++I;
+	  continue;
+	}
+	if (I2->first < I->first) {
+	  ++I2;
+	  continue;
+	}
+	const Symbol Key = I->first;
+	const_iterator GroupEnd = I, GroupEnd2 = I2;
+	while (GroupEnd != E && GroupEnd->first == Key)
+	  ++GroupEnd;
+	while (GroupEnd2 != E2 && GroupEnd2->first == Key)
+	  ++GroupEnd2;
+	for (; I != GroupEnd; ++I)
+	  for (const_iterator J = I2; J != GroupEnd2; ++J)
+	    if (I->second != J->second)
+	      return true;
+	I2 = GroupEnd2;
+      }
+      return false;
+    }
+  };
+
+  // This map stores a mapping of virtual to real registers. This occur
   // when an expression matches with an instruction that uses real registers
   // in its semantics.
-  typedef std::pair<std::string, std::string> RegPair;
-  typedef std::list<RegPair> VirtualToRealMap;
-  // This list stores a mapping of virtual registers to their register
+  typedef std::pair<Symbol, Symbol> RegPair;
+  typedef RestrictionMap<Symbol> VirtualToRealMap;
+  // This map stores a mapping of virtual registers to their register
   // classes, if this needs to be enforced in the search.
-  typedef std::pair<std::string, const RegisterClass*> VCPair;
-  typedef std::list<VCPair> VirtualClassesMap;
+  typedef std::pair<Symbol, const RegisterClass*> VCPair;
+  typedef RestrictionMap<const RegisterClass*> VirtualClassesMap;
   // This list stores the rules applied to the searched expression for
   // debugging reasons.
   typedef std::list<unsigned> RulesAppliedList;
@@ -61,31 +164,41 @@ namespace backendgen {
   // bound. The virtual-classes says which tree leafs (operands) are
   // restricted to use a specific register class.
   class SearchRestrictions {
-    VirtualToRealMap* VR;
-    VirtualClassesMap* VC;
+    VirtualToRealMap VR;
+    VirtualClassesMap VC;
+    // Virtual-to-real bindings seen through this set without being
+    // copied into it (see LayerOn)
+    const VirtualToRealMap* BaseVR;
   public:
-    SearchRestrictions(VirtualToRealMap* vr=0,
-		       VirtualClassesMap* vc = 0);
-    ~SearchRestrictions();
+    SearchRestrictions() : BaseVR(NULL) {}
+    // Storage is recycled through a pool (see TrimSearchPools)
+    static void* operator new(size_t Size);
+    static void operator delete(void* P);
+    // Makes lookups and additions of virtual-to-real bindings also see
+    // those of Base, as if they had been merged into this set. Only the
+    // bindings added afterwards are kept here, so they are undone by
+    // Clear() and nothing is copied. Base must outlive the layering,
+    // which Clear() ends.
+    void LayerOn(const SearchRestrictions* Base) { BaseVR = &Base->VR; }
     VirtualToRealMap* getVR() {
-      return VR;
+      return &VR;
     }
     VirtualClassesMap* getVC() {
-      return VC;
+      return &VC;
     }
 
-    void setVR(VirtualToRealMap* e);
-    void setVC(VirtualClassesMap* e);
     bool AddToVRList(RegPair Element);
     void MergeVRList(const VirtualToRealMap* Source);
     bool AddToVCList(VCPair Element);
     void MergeVCList(const VirtualClassesMap* Source);
     void Merge(const SearchRestrictions* Source);    
+    void Swap(SearchRestrictions& B);
+    void Clear();
 
     // Const member functions
-    bool LookupVR(const std::string& Key, const std::string* Result) const;
+    bool LookupVR(const Symbol& Key, const Symbol*& Result) const;
     bool HasConflictingVRDefinitions(const VirtualToRealMap* B) const;
-    bool LookupVC(const std::string& Key, const RegisterClass* Result) const;
+    bool LookupVC(const Symbol& Key, const RegisterClass* Result) const;
     bool HasConflictingVCDefinitions(const VirtualClassesMap* B) const;
     bool HasConflictingDefinitions(const SearchRestrictions* B) const;
     const VirtualToRealMap* getVR() const;
@@ -109,81 +222,435 @@ namespace backendgen {
   // names to use as the operands of this instruction. This implies that
   // in complete search results, the list of operandsdefs is of the same
   // size of the list of instructions.
+  // RulesApplied lists the rules used, each with the operand
+  // transformations it made in OpTrans. Code generation only looks up
+  // OpTrans by operand name; RulesApplied is informational (it is saved
+  // with the result and reported) and is never replayed. With
+  // EGraphStrategy it is not even an application order (see
+  // Search::SaturatedSearch).
+  // The lists are stored inside the result, so a result takes a single
+  // allocation. The pointer members refer to them and are what users of
+  // SearchResult read and modify; they never change.
   struct SearchResult {
-    InstrList *Instructions;    
+  private:
+    InstrList InstructionsData;
+    OperandsDefsType OperandsDefsData;
+    RulesAppliedList RulesAppliedData;
+    OpTransLists OpTransData;
+    SearchRestrictions STData;
+    // Not copyable: see CopySearchResult
+    SearchResult(const SearchResult&);
+    SearchResult& operator= (const SearchResult&);
+  public:
+    InstrList * const Instructions;    
     CostType Cost;
-    OperandsDefsType *OperandsDefs;    
-    RulesAppliedList *RulesApplied;
-    OpTransLists *OpTrans;
-    SearchRestrictions* ST;
+    OperandsDefsType * const OperandsDefs;    
+    RulesAppliedList * const RulesApplied;
+    OpTransLists * const OpTrans;
+    SearchRestrictions * const ST;
     SearchResult();
     ~SearchResult();
+    // Storage is recycled through a pool (see TrimSearchPools)
+    static void* operator new(size_t Size);
+    static void operator delete(void* P);
     void FilterAssignedNames();
     bool CheckVirtualToReal(const Tree *Exp) const;
-    VirtualToRealMap::const_iterator VRLookupName(std::string S) const;
+    VirtualToRealMap::const_iterator VRLookupName(const Symbol& S) const;
     void DumpResults(std::ostream& S) const;
   };
 
+  // Depth recorded for search conclusions that were not limited by the
+  // maximum depth, so no deeper search could change them
+  const unsigned UNBOUNDED_DEPTH = ~0U;
+
   // This class speeds up search algorithm by hashing expressions
   // which are known to lead to a dead end. When such expressions are
   // recognized, the search algorith may safely skip them.
+  // Entries are spread over NUMSHARDS shards by their 64-bit structural
+  // fingerprint. Each shard is an open addressing hash table (linear
+  // probing) that grows when its load factor gets high and, in parallel
+  // search, has its own lock, so threads rarely wait on each other.
+  // The cache may be saved to a file and loaded back by a later run that
+  // uses the same machine description and rules (same version) and
+  // searches the same way (same configuration, see
+  // Search::getConfiguration).
+  // Dead ends found without reaching the maximum depth are recorded with
+  // UNBOUNDED_DEPTH and hold for any depth. Likewise, dead ends found
+  // under a cost bound hold only for that bound or lower ones; the others
+  // are recorded with a budget of INT_MAX.
   class TransformationCache {
     // Inner class containing information for each hash table entry
     // We need to store two trees (one transforming into another) and the
     // depth used to take the conclusion that the expression can not be
-    // transformed.
+    // transformed. Both trees are shared (see NodeFactory). The
+    // fingerprint of the pair is kept, so most probes are decided
+    // without comparing trees.
+    // Entries loaded from a file have no trees (LHS and RHS are NULL) and
+    // only match pairs with the very same ExactFingerprint.
     struct CacheEntry {
+      unsigned long long Fingerprint, ExactFingerprint;
       const Tree *LHS, *RHS;
       unsigned Depth;
-      struct CacheEntry *next;
+      CostType Budget;
+      bool Used;
     };
-    // Each entry in the hash table leads to a colision list, capable
-    // of holding many elements.
-    // The hash table 
-    CacheEntry** HashTable;
-    const unsigned HASHSIZE;
+    struct Shard {
+      CacheEntry* HashTable;
+      unsigned Capacity;
+      unsigned NumEntries;
+#ifdef PARALLEL_SEARCH
+      omp_lock_t Lock;
+#endif
+    };
+    static const unsigned NUMSHARDS = 16;
+    Shard Shards[NUMSHARDS];
 
+    static void Grow(Shard &S);
+    static unsigned long long Fingerprint(const Tree* Exp,
+					  const Tree* Target);
+    static unsigned long long ExactFingerprint(const Tree* Exp,
+					       const Tree* Target);
+    Shard& getShard(unsigned long long Hash) {
+      return Shards[(Hash >> 32) % NUMSHARDS];
+    }
+    void Insert(unsigned long long Hash, unsigned long long ExactHash,
+		const Tree* LHS, const Tree* RHS, unsigned Depth,
+		CostType Budget);
   public:
     // Constructor and destructor signatures
     TransformationCache();
     ~TransformationCache();
     // Public member functions
-    inline void Add(const Tree* Exp, const Tree* Target, unsigned Depth);
-    inline CacheEntry* LookUp(const Tree* Exp, const Tree* Target, 
-			      unsigned Depth) const;   
+    inline void Add(const Tree* Exp, const Tree* Target, unsigned Depth,
+		    CostType Budget);
+    inline bool LookUp(const Tree* Exp, const Tree* Target,
+		       unsigned Depth, CostType Budget, bool& Bounded,
+		       bool& Budgeted);
+    bool Save(const std::string &FileName, unsigned Version,
+	      const std::string &Configuration);
+    bool Load(const std::string &FileName, unsigned Version,
+	      const std::string &Configuration);
+    // Forgets all dead ends
+    void Clear();
+  };
+
+  struct SearchStats;
+
+  // This class memoizes successful searches. A result is stored under a
+  // key made of the searched expression with its operand names abstracted,
+  // the restrictions the search started with on these operands and the
+  // remaining depth. It is replayed for any expression with the same key,
+  // by renaming the operands it refers to and giving fresh names to the
+  // operands created by rule applications.
+  // Searches that never reached the maximum depth are stored once for all
+  // depths at least as large as the one they were found with.
+  class SearchMemo {
+    struct MemoEntry {
+      SearchResult* Result;
+      // Expression operand names, in order of first occurrence
+      NameListType Names;
+      // Depth this search was found with
+      unsigned Depth;
+    };
+    std::map<std::string, MemoEntry> Table;
+    static std::string TableKey(const std::string& Key, unsigned Depth,
+				bool Bounded);
+  public:
+    ~SearchMemo();
+    // Forgets all searches
+    void Clear();
+    static std::string BuildKey(const Tree* Exp, const SearchRestrictions* ST,
+				NameListType& Names);
+    SearchResult* LookUp(const std::string& Key, unsigned Depth,
+			 const NameListType& Names,
+			 const SearchRestrictions* ST, bool& Bounded,
+			 SearchStats& Stats);
+    void Add(const std::string& Key, unsigned Depth, bool Bounded,
+	     const NameListType& Names, const SearchResult* SR,
+	     const SearchRestrictions* ST, SearchStats& Stats);
+  };
+
+  // Ways of exploring the search space (see Search::setStrategy)
+  enum SearchStrategy {
+    // Depth limited search, the caller raises the limit until it succeeds
+    DepthFirstStrategy,
+    // Transformations are ranked by a lower bound of their cost and only
+    // deepened when needed, up to the maximum depth
+    BestFirstStrategy,
+    // The expression is first saturated with equivalences in an e-graph
+    // and its cheapest form is then searched depth first (see EGraph)
+    EGraphStrategy,
+    // Depth first, transforming expressions into instruction semantics as
+    // well as into the forms rules lead back to them (see BackwardForm)
+    BidirectionalStrategy
+  };
+
+  // Backward search limits: rule applications from an instruction
+  // semantic to its forms and forms kept per semantic
+  const unsigned BACKWARD_DEPTH = 2;
+  const unsigned BACKWARD_FORMS = 16;
+
+  // Outcome of a search (see Search::getStatus)
+  enum SearchStatus {
+    // An implementation was found
+    SearchFound,
+    // Nothing was found, but a deeper search may succeed
+    SearchDepthLimited,
+    // The time or node budget ran out before the search was over
+    SearchOutOfBudget,
+    // Nothing was found and no deeper search can succeed
+    SearchImpossible
+  };
+
+  // Resources a search may use (see Search::setBudget). Tasks of a
+  // parallel search share them.
+  struct SearchLimits {
+    // Wall time (see WallTime) the search must stop at, 0 if none
+    double Deadline;
+    // Number of nodes that may be expanded, 0 if no limit
+    unsigned long long MaxNodes;
+    unsigned long long Nodes;
+    // Set once the budget ran out. Tasks of a parallel search read and
+    // set it at the same time, so searches only access it through the
+    // functions below.
+    bool Exhausted;
+    bool isExhausted() const {
+      bool Value;
+#ifdef PARALLEL_SEARCH
+#pragma omp atomic read
+#endif
+      Value = Exhausted;
+      return Value;
+    }
+    void setExhausted() {
+#ifdef PARALLEL_SEARCH
+#pragma omp atomic write
+#endif
+      Exhausted = true;
+    }
+  };
+
+  // Name of a status, as written in reports
+  const char* getStatusName(SearchStatus Status);
+
+  // Counters of the work done by a search (see Search::getStats)
+  struct SearchStats {
+    // Nodes (calls to operator() and TransformExpression) expanded, by
+    // depth
+    std::vector<unsigned long long> Nodes;
+    // Tree comparisons started by the search
+    unsigned long long Compares;
+    // Applications of each rule and how many succeeded, by RuleID
+    std::vector<unsigned long long> RuleAttempts, RuleSuccesses;
+    // Decompositions tried and how many succeeded
+    unsigned long long Decompositions, DecompositionSuccesses;
+    // Lookups in the dead ends cache and in the memo of searches
+    unsigned long long CacheHits, CacheMisses, MemoHits, MemoMisses;
+    // Search records (SearchResult and SearchRestrictions) allocated, and
+    // how many of them were not recycled but taken from the system
+    unsigned long long Allocations, PoolRefills;
+    // Wall time spent by searches with CurDepth 0, by maximum depth
+    std::map<unsigned, double> DepthTimes;
+
+    SearchStats();
+    void Merge(const SearchStats& Other);
+    // Writes these counters as a JSON object
+    void PrintJSON(std::ostream& O) const;
   };
 
+  // Gives memory recycled by search records (SearchResult,
+  // SearchRestrictions and their lists) back to the system. Pools are kept
+  // per thread and only those of the calling thread are trimmed, so search
+  // tasks trim their own before they end.
+  void TrimSearchPools();
+
+  // Adds the names of all operands of Exp to Names
+  void CollectOperandNames(const Tree* Exp, std::set<std::string>& Names);
+
+  // Tells whether the leafs of rule pattern Pattern are either constants
+  // or operands found in Names. Otherwise, applying the rule names new
+  // operands after a fresh number.
+  bool IsDetermined(const Tree* Pattern, const std::set<std::string>& Names);
+
   // Main interface for search algorithms
   class Search {
     TransformationRules& RulesMgr;    
     InstrManager& InstructionsMgr; 
-#ifdef STATIC_TRANSCACHE    
     static TransformationCache TransCache;
-#else
-    TransformationCache TransCache;
-#endif
+    static SearchMemo Memo;
 
     unsigned MaxDepth;
+    // Number of times the search was limited by MaxDepth, be it directly or
+    // through a cached conclusion
+    unsigned Cutoffs;
+    // Number of branches cut by a cost bound, be it directly or through a
+    // cached conclusion. Conclusions drawn under a cut depend on the bound.
+    unsigned BudgetCuts;
+    // Cost of the cheapest instruction, the least any search costs
+    CostType MinInsnCost;
+    SearchStrategy Strategy;
+    // Depth of the first best-first attempt and its increments
+    unsigned InitialDepth, DepthStep;
+    // Budget of this search. Copies made for parallel tasks (see
+    // Search(Search*)) keep pointing to the limits of the search they were
+    // copied from.
+    SearchLimits OwnLimits;
+    SearchLimits* Limits;
+    // Tasks trying candidate semantics in parallel share the lowest cost
+    // found so far (see SpawnCandidateTasks). A task completing an
+    // instruction of cost TaskCost, and the copies it makes, read it as
+    // they search and give up once they can not match it. NULL outside
+    // such tasks.
+    const CostType* SharedBound;
+    CostType TaskCost;
+    // Cutoffs when the last search with CurDepth 0 started
+    unsigned StartCutoffs;
+    // Last expression saturated by EGraphStrategy, the form extracted and
+    // the rules that built its nodes (see EGraph::Extract). Both trees are
+    // shared.
+    const Tree *SaturatedSource, *SaturatedForm;
+    RulesAppliedList SaturatedRules;
+    SearchStats Stats;
+    // Bindings of the match being tried. Trials always start from an
+    // empty set: it is cleared when the match fails and swapped into the
+    // result when it succeeds, so trying a match allocates nothing. Goal
+    // checks of decompositions layer it on the bindings made so far (see
+    // SearchRestrictions::LayerOn) and merge it when they succeed.
+    SearchRestrictions Scratch;
+    // Semantics worth transforming into, by primary operator type of the
+    // expression, with OtherCandidates for types not in Candidates (see
+    // BuildCloseSets), and likewise for backward forms (see
+    // getCloseBackwardForms). Candidates are built before the first search
+    // and backward forms on first use; lists never change afterwards.
+    // Copies made for parallel tasks share the lists of the search they
+    // were copied from and read candidates without locking.
+    struct CloseSemantics {
+      std::map<unsigned, CandidateList> Candidates;
+      CandidateList OtherCandidates;
+      bool Built;
+      std::map<unsigned, BackwardFormList> BackwardForms;
+      CloseSemantics() : Built(false) {}
+    };
+    CloseSemantics OwnCloseSets;
+    CloseSemantics* CloseSets;
+
+    // Copy of Parent for a parallel task. It shares the limits and close
+    // semantics of Parent, but counts its own work (Cutoffs, BudgetCuts,
+    // Stats) and has its own scratch bindings.
+    explicit Search(Search* Parent);
+    // Not implemented: copying would duplicate the close semantics
+    Search(const Search&);
+    Search& operator= (const Search&);
 
     inline bool HasCloseSemantic(unsigned InstrPO, unsigned ExpPO);
+    inline bool OutOfBudget();
+    inline bool isLosing() const;
+    inline void ApplySharedBound(CostType& Budget) const;
+    inline bool isStopped() const;
+    inline void CountNode(unsigned CurDepth);
+    inline void CountRuleAttempt(unsigned RuleID);
+    inline SearchResult* NewResult();
+    void BuildCloseCandidates(unsigned ExpPO, CandidateList& List);
+    void BuildCloseSets();
+    inline const CandidateList& getCloseCandidates(unsigned ExpPO) const;
+    void BuildBackwardForms(BackwardFormList& Forms);
+    const BackwardFormList& getBackwardForms();
+    const BackwardFormList& getCloseBackwardForms(unsigned ExpPO);
+    void TransformToBackwardForms(const Tree* Expression,
+				  const SearchRestrictions* ST,
+				  CostType Bound, SearchResult*& Result);
     SearchResult* TransformExpression(const Tree* Expression,
 				      const Tree* InsnSemantic, 
 				      unsigned CurDepth,
-				      const SearchRestrictions* ST);
+				      const SearchRestrictions* ST,
+				      CostType Budget);
     SearchResult* ApplyDecompositionRule(const Rule *R, const Tree* Expression,
 					 const Tree* Goal, Tree *& MatchedGoal,
 					 unsigned CurDepth, 
-					 const SearchRestrictions* ST);
+					 const SearchRestrictions* ST,
+					 CostType Budget);
     bool TransformExpressionAux(const Tree* Transformed,
 				const Tree* InsnSemantic, SearchResult* Result,
 				unsigned CurDepth, 
-				const SearchRestrictions *ST);
+				const SearchRestrictions *ST,
+				CostType Budget);
+    SearchResult* BestFirstTransform(const Tree* Expression,
+				     const SearchRestrictions* ST,
+				     CostType Bound);
+    SearchResult* SaturatedSearch(const Tree* Expression,
+				  const SearchRestrictions* ST,
+				  CostType Bound);
+    SearchResult* SearchExpression(const Tree* Expression, unsigned CurDepth,
+				   const SearchRestrictions* ST,
+				   CostType Bound, SearchStrategy TopStrategy);
+#ifdef PARALLEL_SEARCH
+    SearchResult* ParallelTransform(const Tree* Expression,
+				    const SearchRestrictions* ST,
+				    CostType Bound);
+    void SpawnCandidateTasks(const Tree* Expression,
+			     const SearchRestrictions* ST, CostType Bound,
+			     std::vector<SearchResult*>& Solutions,
+			     CostType& Best, unsigned& TaskCutoffs,
+			     unsigned& TaskBudgetCuts, SearchStats& TaskStats);
+    // Outcome of SolveSubgoals
+    enum SubgoalsOutcome {
+      SubgoalsSolved,
+      SubgoalsFailed,
+      // Subgoals are not independent, they must be solved in sequence
+      SubgoalsSerial
+    };
+    SubgoalsOutcome SolveSubgoals(const std::vector<const Tree*>& Goals,
+				  const std::vector<const Tree*>* Targets,
+				  unsigned CurDepth, SearchResult* Partial,
+				  CostType ChildBudget, CostType Budget);
+#endif
   public:
     Search(TransformationRules& RulesMgr, InstrManager& InstructionsMgr);
+    // Bound is the cost of the best implementation known to the caller:
+    // branches that can not cost less or the same are cut.
     SearchResult* operator() (const Tree* Expression, unsigned CurDepth,
-			      const SearchRestrictions* ST);
+			      const SearchRestrictions* ST,
+			      CostType Bound = INT_MAX);
+    // Dead ends persistence (see TransformationCache::Save and Load).
+    // Strategy is the one pattern searches use.
+    static bool SaveTransCache(const std::string &FileName,
+			       unsigned Version, SearchStrategy Strategy) {
+      return TransCache.Save(FileName, Version, getConfiguration(Strategy));
+    }
+    static bool LoadTransCache(const std::string &FileName,
+			       unsigned Version, SearchStrategy Strategy) {
+      return TransCache.Load(FileName, Version, getConfiguration(Strategy));
+    }
+    // Forgets the dead ends and searches all searches share, as if no
+    // search ran before
+    static void ClearCaches() {
+      TransCache.Clear();
+      Memo.Clear();
+    }
+    // Build options and strategy that decide which dead ends a search
+    // proves, as a single line of text
+    static std::string getConfiguration(SearchStrategy Strategy);
     unsigned getMaxDepth() { return MaxDepth; }
+    // If this does not change over a failed search, searching again with a
+    // larger maximum depth is pointless
+    unsigned getCutoffs() const { return Cutoffs; }
     void setMaxDepth(unsigned MaxDepth) { this->MaxDepth = MaxDepth; }
+    // With BestFirstStrategy, a single call to operator() explores up to
+    // MaxDepth, starting at InitialDepth and deepening by DepthStep.
+    void setStrategy(SearchStrategy Strategy, unsigned InitialDepth = 1,
+		     unsigned DepthStep = 1) {
+      this->Strategy = Strategy;
+      this->InitialDepth = InitialDepth;
+      this->DepthStep = DepthStep;
+    }
+    SearchStrategy getStrategy() const { return Strategy; }
+    // Limits the following searches to Seconds of wall time and Nodes
+    // expanded nodes, counted from now on. 0 means no limit.
+    void setBudget(double Seconds, unsigned long long Nodes);
+    // Tells how the last search with CurDepth 0, which returned R, ended
+    SearchStatus getStatus(const SearchResult* R) const;
+    // Work done by all searches made with this object
+    const SearchStats& getStats() const { return Stats; }
   };
 
 }
@@ -11,10 +11,100 @@
 #include "Semantic.h"
 #include "../Support.h"
 #include <functional>
+#include <sstream>
 #include <cassert>
 
 namespace backendgen {
 
+  // Symbol member functions
+
+  namespace {
+    // The table of interned names is split in shards, each with its own
+    // lock, so threads interning different names seldom wait for each
+    // other
+    const unsigned SYMBOL_SHARDS = 16;
+    struct SymbolShard {
+      std::map<std::string, unsigned> Table;
+#ifdef PARALLEL_SEARCH
+      omp_lock_t Lock;
+      SymbolShard() { omp_init_lock(&Lock); }
+#endif
+    };
+    unsigned NextSymbolId = 0;
+    // Largest sequence number a symbol holds, see Symbol::assign
+    const unsigned MAXSEQ = 999999999;
+  }
+
+  // Entries are never removed, so they may be referenced without locking.
+  // The table is never freed, so symbols stay valid during exit.
+  const Symbol::EntryType* Symbol::intern(const std::string& Name) {
+    static SymbolShard* Shards = new SymbolShard[SYMBOL_SHARDS];
+    unsigned Hash = 0;
+    for (std::string::const_iterator I = Name.begin(), E = Name.end();
+	 I != E; ++I)
+      Hash = Hash * 31 + static_cast<unsigned char>(*I);
+    SymbolShard& Shard = Shards[Hash % SYMBOL_SHARDS];
+    const EntryType* Entry;
+#ifdef PARALLEL_SEARCH
+    omp_set_lock(&Shard.Lock);
+#endif
+    TableType::iterator I = Shard.Table.find(Name);
+    if (I == Shard.Table.end())
+      I = Shard.Table.insert(std::make_pair
+			     (Name, __sync_fetch_and_add(&NextSymbolId, 1)))
+	.first;
+    Entry = &*I;
+#ifdef PARALLEL_SEARCH
+    omp_unset_lock(&Shard.Lock);
+#endif
+    return Entry;
+  }
+
+  // Splits Name into stem, sequence number and tail. The number is the
+  // run of digits before the first '_' or the end of the name, if it
+  // fits in MAXSEQ, does not start with 0 and is not the whole stem.
+  void Symbol::assign(const std::string& Name) {
+    std::string::size_type Sep = Name.find('_');
+    if (Sep == std::string::npos)
+      Sep = Name.size();
+    std::string::size_type Digits = Sep;
+    while (Digits != 0 && Name[Digits - 1] >= '0' && Name[Digits - 1] <= '9')
+      --Digits;
+    Seq = 0;
+    if (Digits != 0 && Digits != Sep && Name[Digits] != '0' &&
+	Sep - Digits <= 9)
+      for (std::string::size_type I = Digits; I != Sep; ++I)
+	Seq = Seq * 10 + (Name[I] - '0');
+    else
+      Digits = Sep;
+    Stem = intern(Digits == Name.size()? Name : Name.substr(0, Digits));
+    Tail = Sep != Name.size()? intern(Name.substr(Sep)) : NULL;
+  }
+
+  Symbol Symbol::temporary(const Symbol& Base, unsigned Num) {
+    const std::string& BaseStem = Base.Stem->first;
+    if (Base.Seq != 0 || Base.Tail != NULL || Num == 0 || Num > MAXSEQ ||
+	BaseStem.empty() ||
+	(BaseStem[BaseStem.size() - 1] >= '0' &&
+	 BaseStem[BaseStem.size() - 1] <= '9')) {
+      std::stringstream SS;
+      SS << Base << Num;
+      return temporary(SS.str());
+    }
+    Symbol Result(Base);
+    Result.Seq = Num;
+    Result.Temporary = true;
+    return Result;
+  }
+
+  std::string Symbol::str() const {
+    if (Seq == 0 && Tail == NULL)
+      return Stem->first;
+    std::stringstream SS;
+    SS << *this;
+    return SS.str();
+  }
+
   namespace expression {
     
     // Generic hash function based on ELF's hash function for symbol names.
@@ -254,7 +344,7 @@ namespace backendgen {
     // Operand member functions     
 
     unsigned Operand::getHash(unsigned hash_chain) const {
-      return hash<std::string>(OperandName, hash_chain);
+      return hash<std::string>(OperandName.str(), hash_chain);
     }
 
     // Contant member functions
@@ -262,11 +352,11 @@ namespace backendgen {
 
     Constant::Constant (OperandTableManager& Man, const ConstType Val,
 			const OperandType &Type):
-      Operand(Man, Type, "C")
+      Operand(Man, Type, "C", ConstantNode)
     {
       std::stringstream SS;
       Value = Val;
-      SS << "CONST_" << SeqNum++;
+      SS << "CONST_" << __sync_fetch_and_add(&SeqNum, 1);
       this->OperandName = SS.str();
     }
 
@@ -638,12 +728,12 @@ namespace backendgen {
       bool operator() (Tree* Opr) {
 	if (Opr == NULL) return true;
 
-	Operand* O_and = dynamic_cast<Operand*>(Opr);
-	assert (O_and != NULL && "ApplyToLeafs sent us a non-leaf node");
+	assert (Opr->isOperand() && "ApplyToLeafs sent us a non-leaf node");
+	Operand* O_and = static_cast<Operand*>(Opr);
 
 	// Ignore other operands type not register or imm
-	if (!dynamic_cast<const RegisterOperand*>(O_and) &&
-	    !dynamic_cast<const ImmediateOperand*>(O_and))
+	if (O_and->getKind() != RegisterNode &&
+	    O_and->getKind() != ImmediateNode)
 	  return true;
 
 	if (LeafsName->empty()) {
@@ -670,21 +760,20 @@ namespace backendgen {
 	Man(Manager) {}
       // Return false on error     
       bool operator() (Tree* Opr) {
-	Operator* O_ator_ = dynamic_cast<Operator*>(Opr);
 	// Not interested in non-operator nodes
-	if (O_ator_ == NULL)
+	if (!Opr->isOperator())
 	  return true;
-	Operator& O_ator = *O_ator_;
+	Operator& O_ator = *static_cast<Operator*>(Opr);
 
 	FragOperand* Op = NULL;
 	unsigned FragIndex, E = O_ator.getArity();
 	// Now scan for all operands looking for a FragOperand
 	for (FragIndex = 0; FragIndex != E; ++FragIndex)
 	  {	  
-	    Op =  dynamic_cast<FragOperand*>(O_ator[FragIndex]);
 	    // Not interested in non-frag operands
-	    if (Op == NULL)
+	    if (O_ator[FragIndex]->getKind() != FragOperandNode)
 	      continue;
+	    Op = static_cast<FragOperand*>(O_ator[FragIndex]);
 	    break;
 	  }
 
@@ -744,7 +833,7 @@ namespace backendgen {
     RegisterOperand::RegisterOperand(OperandTableManager &Man,
 				     const RegisterClass *RegClass,
 				     const std::string &OpName):
-      Operand(Man, RegClass->getOperandType(), OpName) {
+      Operand(Man, RegClass->getOperandType(), OpName, RegisterNode) {
       MyRegClass = RegClass;      
     }
 
@@ -756,7 +845,183 @@ namespace backendgen {
     ImmediateOperand::ImmediateOperand(OperandTableManager &Man,
 				       const OperandType &Type, 
 				       const std::string &OpName):
-      Operand(Man, Type, OpName) {}
+      Operand(Man, Type, OpName, ImmediateNode) {}
+
+    // NodeFactory member functions
+
+    NodeFactory& NodeFactory::Instance() {
+      static NodeFactory Factory;
+      return Factory;
+    }
+
+    NodeFactory::NodeFactory() {
+#ifdef PARALLEL_SEARCH
+      for (unsigned I = 0; I != NUMBUCKETS; ++I)
+	omp_init_lock(&Buckets[I].Lock);
+#endif
+    }
+
+    NodeFactory::~NodeFactory() {
+      // Shared operators do not own their children, so every node may be
+      // deleted independently.
+      for (unsigned I = 0; I != NUMBUCKETS; ++I) {
+	TableType& Table = Buckets[I].Table;
+	for (TableType::iterator I2 = Table.begin(), E2 = Table.end();
+	     I2 != E2; ++I2)
+	  delete I2->second;
+#ifdef PARALLEL_SEARCH
+	omp_destroy_lock(&Buckets[I].Lock);
+#endif
+      }
+    }
+
+    unsigned NodeFactory::size() const {
+      unsigned Size = 0;
+      for (unsigned I = 0; I != NUMBUCKETS; ++I)
+	Size += Buckets[I].Table.size();
+      return Size;
+    }
+
+    // Children holds the shared versions of the children of N, so their
+    // fingerprints summarize them.
+    unsigned long long
+    NodeFactory::computeFingerprint(const Node* N,
+				    Node* const* Children) const {
+      unsigned long long Hash = FingerprintBasis;
+      // Two nodes of different kinds are never identical, even if all
+      // their fields agree.
+      const NodeKind Kind = N->getKind();
+      Hash = Mix64(Hash, Kind);
+      Hash = Mix64(Hash, N->isTransferDestination());
+      if (Kind == OperatorNode) {
+	const Operator* O = static_cast<const Operator*>(N);
+	Hash = Mix64(Hash, O->Type.Type);
+	Hash = Mix64(Hash, O->Type.Arity);
+	Hash = Mix64(Hash, O->ReturnType.Type);
+	Hash = Mix64(Hash, O->ReturnType.Size);
+	Hash = Mix64(Hash, O->ReturnType.DataType);
+	for (int I = 0, E = O->getArity(); I != E; ++I)
+	  Hash = Mix64(Hash, Children[I]->Fingerprint);
+	return Hash;
+      }
+      const Operand* O = static_cast<const Operand*>(N);
+      Hash = Mix64(Hash, O->Type.Type);
+      Hash = Mix64(Hash, O->Type.Size);
+      Hash = Mix64(Hash, O->Type.DataType);
+      Hash = Mix64(Hash, O->SpecificReference);
+      Hash = Mix64(Hash, O->AcceptsSpecificReference);
+      Hash = Mix64(Hash, O->OperandName.getHash());
+      Hash = Mix64(Hash, O->OperandName.isTemporary());
+      if (Kind == ConstantNode)
+	Hash = Mix64(Hash, static_cast<const Constant*>(N)->getConstValue());
+      return Hash;
+    }
+
+    // Tells whether shared node A is the shared version of B, whose
+    // children have Children as shared versions. Children of A are
+    // compared by address.
+    bool NodeFactory::identical(const Node* A, const Node* B,
+				Node* const* Children) const {
+      const NodeKind Kind = A->getKind();
+      if (Kind != B->getKind() ||
+	  A->isTransferDestination() != B->isTransferDestination())
+	return false;
+      if (Kind == OperatorNode) {
+	const Operator* OA = static_cast<const Operator*>(A);
+	const Operator* OB = static_cast<const Operator*>(B);
+	if (OA->Type.Type != OB->Type.Type ||
+	    OA->Type.Arity != OB->Type.Arity ||
+	    &OA->Manager != &OB->Manager ||
+	    OA->ReturnType.Type != OB->ReturnType.Type ||
+	    OA->ReturnType.Size != OB->ReturnType.Size ||
+	    OA->ReturnType.DataType != OB->ReturnType.DataType)
+	  return false;
+	for (int I = 0, E = OA->getArity(); I != E; ++I)
+	  if (OA->Children[I] != Children[I])
+	    return false;
+	return true;
+      }
+      const Operand* OA = static_cast<const Operand*>(A);
+      const Operand* OB = static_cast<const Operand*>(B);
+      if (OA->Type.Type != OB->Type.Type ||
+	  OA->Type.Size != OB->Type.Size ||
+	  OA->Type.DataType != OB->Type.DataType ||
+	  &OA->Manager != &OB->Manager ||
+	  OA->SpecificReference != OB->SpecificReference ||
+	  OA->AcceptsSpecificReference != OB->AcceptsSpecificReference ||
+	  OA->OperandName != OB->OperandName ||
+	  OA->OperandName.isTemporary() != OB->OperandName.isTemporary())
+	return false;
+      if (Kind == ConstantNode)
+	return static_cast<const Constant*>(A)->getConstValue() ==
+	  static_cast<const Constant*>(B)->getConstValue();
+      if (Kind == RegisterNode)
+	return static_cast<const RegisterOperand*>(A)->getRegisterClass() ==
+	  static_cast<const RegisterOperand*>(B)->getRegisterClass();
+      return true;
+    }
+
+    // Children are interned first, so N is looked up by its own fields and
+    // the addresses of their shared versions. N is only copied when it is
+    // not found. Only the bucket of N is locked, and only while it is
+    // looked up and, if need be, extended.
+    Node* NodeFactory::internAux(const Node* N) {
+      if (N->Shared)
+	return const_cast<Node*>(N);
+      assert(N->getKind() != FragOperandNode &&
+	     "Fragments must be expanded before sharing the tree");
+
+      Node* LocalChildren[MAXLOCALARITY];
+      std::vector<Node*> MoreChildren;
+      // Leaves have no children to look at
+      Node** Children = NULL;
+      const Operator* O = NULL;
+      if (N->isOperator()) {
+	O = static_cast<const Operator*>(N);
+	Children = LocalChildren;
+	if (O->getArity() > MAXLOCALARITY) {
+	  MoreChildren.resize(O->getArity());
+	  Children = &MoreChildren[0];
+	}
+	for (int I = 0, E = O->getArity(); I != E; ++I)
+	  Children[I] = internAux(O->Children[I]);
+      }
+
+      const unsigned long long Fingerprint = computeFingerprint(N, Children);
+      Bucket& B = Buckets[(Fingerprint >> 32) % NUMBUCKETS];
+      Node* Result = NULL;
+#ifdef PARALLEL_SEARCH
+      omp_set_lock(&B.Lock);
+#endif
+      for (TableType::iterator I = B.Table.lower_bound(Fingerprint),
+	     E = B.Table.upper_bound(Fingerprint); I != E; ++I) {
+	if (identical(I->second, N, Children)) {
+	  Result = I->second;
+	  break;
+	}
+      }
+      if (Result == NULL) {
+	if (O != NULL) {
+	  Operator* Copy = new Operator(*O);
+	  for (int I = 0, E = O->getArity(); I != E; ++I)
+	    Copy->Children[I] = Children[I];
+	  Result = Copy;
+	} else {
+	  Result = N->clone();
+	}
+	Result->Shared = true;
+	Result->Fingerprint = Fingerprint;
+	B.Table.insert(std::make_pair(Fingerprint, Result));
+      }
+#ifdef PARALLEL_SEARCH
+      omp_unset_lock(&B.Lock);
+#endif
+      return Result;
+    }
+
+    Node* NodeFactory::intern(const Node* N) {
+      return internAux(N);
+    }
 
     // PatternManager member functions
 
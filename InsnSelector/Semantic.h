@@ -19,20 +19,110 @@
 #include <list>
 #include <set>
 #include <cassert>
+#ifdef PARALLEL_SEARCH
+#include <omp.h>
+#endif
 
 namespace backendgen {
+
+  // Operand and register names are interned: each distinct name is kept
+  // once in a global table and referred to by a Symbol, so symbols are
+  // compared and ordered without looking at their strings.
+  // Rule applications make up new names by appending a sequence number to
+  // a rule operand name, possibly followed by '_' and another name (see
+  // SubstituteLeafs). So that these do not fill the table, a name is
+  // split into a stem, the number that ends the part before the first
+  // '_' and the rest: only the stem and the rest are interned. Every name
+  // is split the same way, whatever made it, so equal names always have
+  // equal symbols.
+  class Symbol {
+    typedef std::map<std::string, unsigned> TableType;
+    typedef TableType::value_type EntryType;
+    const EntryType* Stem;
+    // Part of the name from the first '_' on, NULL if none
+    const EntryType* Tail;
+    // Sequence number, 0 if none
+    unsigned Seq;
+    // Whether the name was made up by a rule application (see temporary).
+    // It is not part of the name: a temporary equals any symbol spelled
+    // the same way.
+    bool Temporary;
+    static const EntryType* intern(const std::string& Name);
+    void assign(const std::string& Name);
+    unsigned getTailId() const { return Tail != NULL? Tail->second + 1 : 0; }
+  public:
+    Symbol(const std::string& Name) : Temporary(false) { assign(Name); }
+    Symbol(const char* Name) : Temporary(false) { assign(Name); }
+    // A name made up for an operand a rule application creates (see
+    // SubstituteLeafs), which may be renumbered when the tree it is part
+    // of is reused elsewhere
+    static Symbol temporary(const std::string& Name) {
+      Symbol Result(Name);
+      Result.Temporary = true;
+      return Result;
+    }
+    // Temporary named Base followed by Num, which interns nothing unless
+    // Base ends with a digit
+    static Symbol temporary(const Symbol& Base, unsigned Num);
+    bool isTemporary() const { return Temporary; }
+    std::string str() const;
+    operator std::string() const { return str(); }
+    // Hash of the name, the same for equal symbols
+    unsigned long long getHash() const {
+      return (static_cast<unsigned long long>(Stem->second) << 32 ^ Seq) *
+	0x9e3779b97f4a7c15ULL + getTailId();
+    }
+    friend bool operator== (const Symbol& A, const Symbol& B) {
+      return A.Stem == B.Stem && A.Seq == B.Seq && A.Tail == B.Tail;
+    }
+    friend bool operator!= (const Symbol& A, const Symbol& B) {
+      return !(A == B);
+    }
+    // Symbols are ordered by the order their stems were first interned,
+    // then by number
+    friend bool operator< (const Symbol& A, const Symbol& B) {
+      if (A.Stem != B.Stem)
+	return A.Stem->second < B.Stem->second;
+      if (A.Seq != B.Seq)
+	return A.Seq < B.Seq;
+      return A.getTailId() < B.getTailId();
+    }
+    friend std::ostream& operator<< (std::ostream& S, const Symbol& Sym);
+  };
+
+  inline std::ostream& operator<< (std::ostream& S, const Symbol& Sym) {
+    S << Sym.Stem->first;
+    if (Sym.Seq != 0)
+      S << Sym.Seq;
+    if (Sym.Tail != NULL)
+      S << Sym.Tail->first;
+    return S;
+  }
 	 
   // Expression namespace encapsulates all classes related to
   // expression trees (the tree itself and its nodes).
   namespace expression {
     
+    class NodeFactory;
+
+    // Concrete class of a node. Hot paths dispatch on it with a switch
+    // and static_cast instead of trying dynamic_cast on every class.
+    enum NodeKind {OperandNode=1, FragOperandNode, ConstantNode, RegisterNode,
+		   ImmediateNode, OperatorNode};
+
     // An expression tree node.
+    // Nodes built by NodeFactory are shared (hash-consed): they may be
+    // referenced by several trees at once and must never be changed or
+    // deleted by their users. Copying a node always yields an unshared one.
     class Node {
     public:
+      explicit Node(NodeKind K) : Kind(K), Shared(false), Fingerprint(0) { }
+      Node(const Node& N) : Kind(N.Kind), Shared(false), Fingerprint(0) { }
       virtual void print(std::ostream& S) const { S << "GenericNode";  }
       virtual ~Node() { }
-      virtual bool isOperand() const { return false; }
-      virtual bool isOperator() const { return false; }
+      NodeKind getKind() const { return Kind; }
+      bool isOperand() const { return Kind != OperatorNode; }
+      bool isOperator() const { return Kind == OperatorNode; }
       virtual unsigned getType() const { return 0; }
       virtual unsigned getSize() const { return 0; }
       virtual Node* clone() const = 0;
@@ -40,6 +130,15 @@ namespace backendgen {
       virtual unsigned getHash() const { return getHash(0); }
       virtual bool isTransferDestination() const = 0;
       virtual void setIsTransferDestination(bool NewVal) = 0;
+      bool isShared() const { return Shared; }
+      // Structural fingerprint, only meaningful for shared nodes (0 if
+      // the node was not built by NodeFactory).
+      unsigned long long getFingerprint() const { return Fingerprint; }
+    private:
+      friend class NodeFactory;
+      const NodeKind Kind;
+      bool Shared;
+      unsigned long long Fingerprint;
     };
 
     // An expression tree, representing a single assertion of an
@@ -121,9 +220,9 @@ namespace backendgen {
     class Operand : public Node {
     public:
       Operand (OperandTableManager &Man, const OperandType &Type,
-	       const std::string &OpName): Manager(Man) {
+	       const std::string &OpName, NodeKind Kind = OperandNode):
+	Node(Kind), OperandName(OpName), Manager(Man) {
 	this->Type = Type;
-	OperandName = OpName;
 	SpecificReference = false;
 	AcceptsSpecificReference = false;
 	IsTransferDestination = false;
@@ -133,7 +232,6 @@ namespace backendgen {
 	if (IsTransferDestination)
 	  S << "*";
       }
-      virtual bool isOperand() const { return true; }
       virtual unsigned getType() const { return Type.Type; }
       virtual unsigned getSize() const {
 	return Type.Size;
@@ -144,27 +242,37 @@ namespace backendgen {
 	return IsTransferDestination; 
       }
       virtual void setIsTransferDestination(bool NewVal) {
+	assert ((!isShared() || NewVal == IsTransferDestination) &&
+		"Shared nodes are immutable");
 	IsTransferDestination = NewVal;
       }
       void updateSize() {
+	assert (!isShared() && "Shared nodes are immutable");
 	Type = Manager.getType(Manager.getTypeName(Type));
       }
-      const std::string& getOperandName() const {return OperandName;}
+      std::string getOperandName() const {return OperandName.str();}
+      Symbol getOperandSymbol() const { return OperandName; }
       unsigned getDataType() const { return Type.DataType; }
       bool isSpecificReference() const { return SpecificReference; }
-      void setSpecificReference(bool Val) {SpecificReference = Val; }
+      void setSpecificReference(bool Val) {
+	assert (!isShared() && "Shared nodes are immutable");
+	SpecificReference = Val;
+      }
       void setAcceptsSpecificReference(bool Val) {
+	assert (!isShared() && "Shared nodes are immutable");
 	AcceptsSpecificReference = Val;
       }
       bool acceptsSpecificReference() const {
 	return AcceptsSpecificReference;
       }
-      void changeOperandName(const std::string &NewName) {
+      void changeOperandName(const Symbol &NewName) {
+	assert (!isShared() && "Shared nodes are immutable");
 	OperandName = NewName;
       }
     protected:      
+      friend class NodeFactory;
       OperandType Type;
-      std::string OperandName;
+      Symbol OperandName;
       // The operand name bounds to an assembly operand, in which
       // case the exact reference is determined by the assembly construct, OR 
       // it refers directly to a specific register in the architecture.
@@ -181,7 +289,9 @@ namespace backendgen {
     public:
       FragOperand(OperandTableManager &Man, const std::string &OpName,
 		  std::list<std::string>&List): 
-	Operand(Man, OperandType(), OpName), ParameterList(List) {}
+	Operand(Man, OperandType(), OpName, FragOperandNode),
+	ParameterList(List) {}
+      virtual Node* clone() const { return new FragOperand(*this); }
       std::list<std::string>& getParameterList() { return ParameterList; }
     };    
 
@@ -441,7 +551,7 @@ namespace backendgen {
     protected:
       // Constructor
       Operator(OperatorTableManager &Man, OperatorType OpType):
-        Node(), Children(OpType.Arity), Type(OpType), Manager(Man)
+        Node(OperatorNode), Children(OpType.Arity), Type(OpType), Manager(Man)
       {
 	ReturnType.Type = 0;
 	ReturnType.Size = 0;
@@ -471,10 +581,11 @@ namespace backendgen {
 	return Type.Type == AssignOp;
       }
       void setChild(int index, Node *N) {
+	assert (!isShared() && "Shared nodes are immutable");
 	if (Type.Type == AssignOp && index == 0) {
 	  //if (Children[0] != 0) 
 	    //Children[0]->setIsTransferDestination(false);	
-	  if (N != 0)
+	  if (N != 0 && !N->isTransferDestination())
 	    N->setIsTransferDestination(true);
 	  Children[0] = N;
 	  return;
@@ -493,32 +604,44 @@ namespace backendgen {
 	else
 	  S << ") ";
       }
-      virtual bool isOperator() const { return true; }
       virtual unsigned getType() const { return (unsigned) Type.Type; }
       virtual unsigned getSize() const { return ReturnType.Size; }
       virtual bool isTransferDestination() const {
 	return IsTransferDestination; 
       }
       virtual void setIsTransferDestination(bool NewVal) {
+	assert ((!isShared() || NewVal == IsTransferDestination) &&
+		"Shared nodes are immutable");
 	IsTransferDestination = NewVal;
       }
+      // Only the spine of unshared nodes is copied. Shared subtrees are
+      // immutable and are simply referenced by the copy.
       virtual Node* clone() const { 
 	Operator* Pointer = new Operator(*this);
 	for (unsigned I = 0, E = Type.Arity; I < E; ++I) 
 	  {
-	    Pointer->setChild(I, Children[I]->clone());
+	    Node* Child = Children[I];
+	    if (Child->isShared() && (I != 0 || Type.Type != AssignOp ||
+				      Child->isTransferDestination()))
+	      Pointer->setChild(I, Child);
+	    else
+	      Pointer->setChild(I, Child->clone());
 	  }	
 	return Pointer; 
       }
       virtual ~Operator() {
+	// Shared operators do not own their children (see NodeFactory)
+	if (isShared())
+	  return;
 	for (unsigned I = 0, E = Type.Arity; I < E; ++I) 
 	  {
-	    if (Children[I] != NULL)
+	    if (Children[I] != NULL && !Children[I]->isShared())
 	      delete Children[I];
 	  }
       }
       virtual unsigned getHash(unsigned hash_chain) const;
       void detachNode() { 
+	assert (!isShared() && "Shared nodes are immutable");
 	if (Type.Type == AssignOp && Children[0] != 0)
 	  Children[0]->setIsTransferDestination(false);	  
 	for (unsigned I = 0, E = Type.Arity; I < E; ++I) 
@@ -537,8 +660,89 @@ namespace backendgen {
       OperandType ReturnType;
       OperatorTableManager &Manager;
       bool IsTransferDestination;
+      friend class NodeFactory;
     };     
 
+    // Extracts an expression's primary operator type: the type of its top
+    // level operator, or of the value being assigned if this operator is
+    // an assignment. Leafs have primary operator type 0.
+    inline unsigned PrimaryOperatorType (const Tree* Expression)
+    {
+      if (!Expression->isOperator())
+	return 0;
+
+      const Operator* O = static_cast<const Operator*>(Expression);
+      if (O->getType() == AssignOp) {
+	return PrimaryOperatorType((*O)[1]);
+      }
+
+      return O->getType();
+    }
+
+    // 64-bit FNV-1a helpers used to build structural fingerprints.
+    const unsigned long long FingerprintBasis = 14695981039346656037ULL;
+
+    inline unsigned long long Mix64(unsigned long long Hash,
+				    unsigned long long Val) {
+      for (unsigned I = 0; I < 8; ++I) {
+	Hash ^= (Val >> (I * 8)) & 0xff;
+	Hash *= 1099511628211ULL;
+      }
+      return Hash;
+    }
+
+    inline unsigned long long Mix64(unsigned long long Hash,
+				    const std::string &S) {
+      for (std::string::const_iterator I = S.begin(), E = S.end(); I != E;
+	   ++I) {
+	Hash ^= static_cast<unsigned char>(*I);
+	Hash *= 1099511628211ULL;
+      }
+      return Mix64(Hash, S.size());
+    }
+
+    // Hash-consing factory for expression trees. Structurally identical
+    // subtrees are stored only once and shared by every tree referencing
+    // them, so two shared nodes are equal if and only if they are the same
+    // pointer.
+    // Shared nodes live until the program ends: the table only grows, by
+    // one node per distinct subtree ever interned. Rule applications
+    // intern the subtrees they match and the dead ends cache interns the
+    // trees it records, so memory grows with the number of distinct
+    // subtrees searches come across, not with the number of rewrites.
+    // The table is split in buckets by fingerprint, each with its own
+    // lock in parallel search.
+    class NodeFactory {
+    public:
+      static NodeFactory& Instance();
+      ~NodeFactory();
+      // Returns the shared node structurally identical to N. If N is
+      // already shared, it is returned unchanged. N is never modified.
+      // Nodes of N are only copied if they are not in the table yet.
+      Node* intern(const Node* N);
+      unsigned size() const;
+    private:
+      typedef std::multimap<unsigned long long, Node*> TableType;
+      struct Bucket {
+	TableType Table;
+#ifdef PARALLEL_SEARCH
+	omp_lock_t Lock;
+#endif
+      };
+      static const unsigned NUMBUCKETS = 64;
+      Bucket Buckets[NUMBUCKETS];
+      // Operators with more children are looked up with a copy of their
+      // list of children (see internAux)
+      static const int MAXLOCALARITY = 4;
+      NodeFactory();
+      NodeFactory(const NodeFactory&);
+      Node* internAux(const Node* N);
+      unsigned long long computeFingerprint(const Node* N,
+					    Node* const* Children) const;
+      bool identical(const Node* A, const Node* B,
+		     Node* const* Children) const;
+    };
+
     struct PatternElement {
       std::string Name;
       std::string LLVMDAG;
@@ -15,6 +15,8 @@
 #include <sstream>
 #include <cstdlib>
 #include <cassert>
+#include <climits>
+#include <algorithm>
 
 namespace backendgen {
 
@@ -28,7 +30,7 @@ namespace backendgen {
     if (T->isOperator()) {
       if (T->getType() == OpType)
 	return true;
-      Operator *O = dynamic_cast<Operator*>(T);
+      Operator *O = static_cast<Operator*>(T);
       for (int I = 0, E = O->getArity(); I != E; ++I)
 	{
 	  if (FindOperator((*O)[I], OpType))
@@ -43,7 +45,8 @@ namespace backendgen {
 
   // Constructor
   Rule::Rule(Tree* LHS, Tree* RHS, bool Equivalence, unsigned Id):
-    LHS(LHS),RHS(RHS),Equivalence(Equivalence),RuleID(Id),OpTransList()
+    LHS(LHS),RHS(RHS),Equivalence(Equivalence),RuleID(Id),OpTransList(),
+    Compiled(NULL)
   {
     Composition = FindOperator(LHS, DecompOp);
     Decomposition = FindOperator(RHS, DecompOp);
@@ -51,15 +54,13 @@ namespace backendgen {
   
   Rule::Rule(Tree* LHS, Tree* RHS, bool Equivalence, unsigned Id,
 	     OperandTransformationList &OList):
-    LHS(LHS),RHS(RHS),Equivalence(Equivalence),RuleID(Id),OpTransList(OList)
+    LHS(LHS),RHS(RHS),Equivalence(Equivalence),RuleID(Id),OpTransList(OList),
+    Compiled(NULL)
   {
     Composition = FindOperator(LHS, DecompOp);
     Decomposition = FindOperator(RHS, DecompOp);
   }
 
-  typedef std::pair<std::string,const Tree*> AnnotatedTree;
-  typedef std::list<AnnotatedTree> AnnotatedTreeList;
-  
   // This auxiliary function is similar to Search.cpp:Compare(),
   // except that rules comparison are stricter, since we need
   // to match exact data types, unless explictly said by the
@@ -92,37 +93,33 @@ namespace backendgen {
 	  // If not wildcard, then it must be a perfect match.
 	  if (R->getType() != 0) {
 	    
-	    const Constant* C1 = dynamic_cast<const Constant*>(R);
-	    const Constant* C2 = dynamic_cast<const Constant*>(E);
+	    const NodeKind K1 = R->getKind(), K2 = E->getKind();
 	    // If rule is not constant, it may as well match a constant
-	    if (C1 != NULL && C2 == NULL) {
+	    if (K1 == ConstantNode && K2 != ConstantNode) {
 	      if (!JustCompare) delete Result;
 	      return NULL;
 	    }
 	    // Depending on the operand type, we need to make further checkings
 	    // Constants must be equal
-	    if (C1 != NULL) {	    	    	    
-	      if (C1->getConstValue() != C2->getConstValue()) {
+	    if (K1 == ConstantNode) {
+	      if (static_cast<const Constant*>(R)->getConstValue() !=
+		  static_cast<const Constant*>(E)->getConstValue()) {
 		if (!JustCompare) delete Result;
 		return NULL;
 	      }
 	    }
 	    
 	    // Immediate handling
-	    const ImmediateOperand* I1 = 
-	      dynamic_cast<const ImmediateOperand*>(R);
-	    const ImmediateOperand* I2 = 
-	      dynamic_cast<const ImmediateOperand*>(E);
-	    if ((I1 == NULL && I2 != NULL) || (I1 != NULL && I2 == NULL)) {
+	    if ((K1 == ImmediateNode) != (K2 == ImmediateNode)) {
 	      if (!JustCompare) delete Result;
 	      return NULL;
 	    }
 	  }
 
 	  // References to specific registers must be equal
-	  const Operand * O1 = dynamic_cast<const Operand*>(R);	 
+	  const Operand * O1 = static_cast<const Operand*>(R);	 
 #if 0
-	  const Operand * O2 = dynamic_cast<const Operand*>(E);
+	  const Operand * O2 = static_cast<const Operand*>(E);
 	  assert (O1 != NULL && O2 != NULL && "Nodes must be operands");
 	  if ((O2->isSpecificReference() && !O1->isSpecificReference()) ||
 	      (!O2->isSpecificReference() && O1->isSpecificReference())) {
@@ -147,8 +144,8 @@ namespace backendgen {
 	
 	// Now we know we are handling with operators and may safely cast
 	// and analyze its children
-	const Operator *RO = dynamic_cast<const Operator*>(R),
-	  *EO = dynamic_cast<const Operator*>(E);
+	const Operator *RO = static_cast<const Operator*>(R),
+	  *EO = static_cast<const Operator*>(E);
 	for (int I = 0, E = RO->getArity(); I != E; ++I) {
 	  AnnotatedTreeList* ChildResult = 
 	    MatchExpByRule<JustCompare>((*RO)[I], (*EO)[I]);
@@ -176,7 +173,7 @@ namespace backendgen {
     // We can also match if a rule operand matches an expression operator
     if (R->isOperand() && E->isOperator())
       {
-	const Operator *EO = dynamic_cast<const Operator*>(E);	
+	const Operator *EO = static_cast<const Operator*>(E);	
 	//NOTE: MemRef is a special case not affected by wildcard rules
 	//NOTE: Transfer destinations are not affected by wildcard rules
 	if ((EO->getReturnTypeType() == R->getType() &&
@@ -188,7 +185,7 @@ namespace backendgen {
 	    if (JustCompare)
 	      return reinterpret_cast<AnnotatedTreeList*>(1);
 	    AnnotatedTreeList* Result = new AnnotatedTreeList();
-	    const Operand* Op = dynamic_cast<const Operand*>(R);
+	    const Operand* Op = static_cast<const Operand*>(R);
 	    AnnotatedTree AT(Op->getOperandName(), E);
 	    Result->push_back(AT);
 	    return Result;
@@ -198,10 +195,29 @@ namespace backendgen {
       return 0;
     return NULL;
   }
+
+  AnnotatedTreeList* InterpretPattern(const Tree* Pattern, const Tree* Exp) {
+    return MatchExpByRule<false>(Pattern, Exp);
+  }
+
+  bool MatchRuleNode(const Tree* R, const Tree* E) {
+    if (R->isOperand())
+      return MatchExpByRule<true>(R, E) != 0;
+    if (!E->isOperator() || static_cast<const Operator*>(R)->getArity() !=
+	static_cast<const Operator*>(E)->getArity())
+      return false;
+    // Same test MatchExpByRule does on operators
+    return (R->getType() == E->getType() &&
+	    (R->getSize() == E->getSize() || R->getSize() == 0 ||
+	     E->getSize() == 0)) ||
+      (R->getType() == 0 && E->getType() != MemRefOp &&
+       !E->isTransferDestination());
+  }
+
   bool SubstituteRoot(Tree** T, AnnotatedTreeList* List,
 		       const OperandTransformationList& OpTransList) {
     if ((*T)->isOperand()) {
-      Operand *O = dynamic_cast<Operand*>(*T);
+      Operand *O = static_cast<Operand*>(*T);
       bool Matched = false;
       for (AnnotatedTreeList::const_iterator I = List->begin(),
 	     E = List->end(); I != E; ++I)
@@ -229,7 +245,7 @@ namespace backendgen {
 		       const OperandTransformationList& OpTransList, 
 		       Operator* Parent = 0, int ChildIndex = -1) {
     if (T->isOperator()) {      
-      Operator *O = dynamic_cast<Operator*>(T);
+      Operator *O = static_cast<Operator*>(T);
       for (int I = 0, E = O->getArity(); I != E; ++I)
 	{
 	  SubstituteLeafs((*O)[I], List, OpTransList, O, I);
@@ -238,7 +254,7 @@ namespace backendgen {
     }
 
     if (T->isOperand()) {
-      Operand *O = dynamic_cast<Operand*>(T);
+      Operand *O = static_cast<Operand*>(T);
       bool Matched = false;
       for (AnnotatedTreeList::const_iterator I = List->begin(),
 	     E = List->end(); I != E; ++I)
@@ -246,7 +262,15 @@ namespace backendgen {
 	  if (I->first == O->getOperandName()) {	    
 	    Matched = true;
 	    assert (Parent != 0 && "Cannot change root node");
-	    Parent->setChild(ChildIndex, I->second->clone());
+	    // Matched subtrees are not copied, but shared with Expression's
+	    // hash-consed version. A transfer destination must carry its
+	    // flag, so a copy is made when the shared node lacks it.
+	    if (Parent->isAssignOp() && ChildIndex == 0 &&
+		!I->second->isTransferDestination())
+	      Parent->setChild(ChildIndex, I->second->clone());
+	    else
+	      Parent->setChild(ChildIndex,
+			       NodeFactory::Instance().intern(I->second));
 	    delete T;
 	    break;
 	  }
@@ -270,11 +294,13 @@ namespace backendgen {
 	{
 	  if (I->first == Name) {
 	    std::stringstream SS;
-	    const Operand* Opand = dynamic_cast<const Operand*>(I->second);
-	    assert(Opand != NULL && "OpTrans. must refer to operand");
+	    assert(I->second->isOperand() && "OpTrans. must refer to operand");
+	    const Operand* Opand = static_cast<const Operand*>(I->second);
 	    Matched = true;
 	    SS << Opand->getOperandName() << "_" << O->getOperandName();
-	    O->changeOperandName(SS.str());
+	    O->changeOperandName(Opand->getOperandSymbol().isTemporary()?
+				 Symbol::temporary(SS.str()) :
+				 Symbol(SS.str()));
 	    break;
 	  }
 	}
@@ -284,14 +310,22 @@ namespace backendgen {
 	return;
       // Otherwise...     
       std::string OldName = O->getOperandName();
-      std::stringstream SS;
-      SS << OldName << Rule::OpNum++;
-      O->changeOperandName(SS.str());
+      O->changeOperandName(Symbol::temporary(O->getOperandSymbol(),
+					     Rule::NextOpNum()));
       AnnotatedTree AT(OldName, O);
       List->push_back(AT);            
     }
   }
 
+  Tree* InstantiatePattern(const Tree* Pattern, AnnotatedTreeList* List,
+			   const OperandTransformationList& OpTransList)
+  {
+    Tree *Result = Pattern->clone();
+    if (!SubstituteRoot(&Result, List, OpTransList))
+      SubstituteLeafs(Result, List, OpTransList);
+    return Result;
+  }
+
   // Match the Expression with pattern Patt1 and, if successfull,
   // transform it in Patt2. Otherwise, return NULL;
   Tree* Apply(const Tree *Patt1, const Tree* Patt2, const Tree* Expression,
@@ -303,22 +337,26 @@ namespace backendgen {
     if (List == NULL)
       return NULL;
 
-    Tree *Result = Patt2->clone();
-    if (!SubstituteRoot(&Result, List, OpTransList))
-      SubstituteLeafs(Result, List, OpTransList);
+    Tree *Result = InstantiatePattern(Patt2, List, OpTransList);
     delete List;
 
     return Result;
   }
 
   bool Rule::ForwardMatch(const expression::Tree* Expression) const {
+    if (Compiled != NULL)
+      return Compiled->ForwardMatch(Expression, NULL);
     if (reinterpret_cast<long>(MatchExpByRule<true>(LHS, Expression)) == 1L)
       return true;
     return false;
   }
 
   bool Rule::BackwardMatch(const expression::Tree* Expression) const {    
-    if (Equivalence && reinterpret_cast<long>(MatchExpByRule<true>(RHS, 
+    if (!Equivalence)
+      return false;
+    if (Compiled != NULL)
+      return Compiled->BackwardMatch(Expression, NULL);
+    if (reinterpret_cast<long>(MatchExpByRule<true>(RHS, 
       Expression)) == 1L)
       return true;
     return false;
@@ -326,11 +364,15 @@ namespace backendgen {
 
   Tree* Rule::ForwardApply(const Tree* Expression) const
   {
+    if (Compiled != NULL)
+      return Compiled->ForwardApply(Expression, *this);
     return Apply(LHS, RHS, Expression, OpTransList);
   }
 
   Tree* Rule::BackwardApply(const Tree* Expression) const
   {
+    if (Compiled != NULL)
+      return Compiled->BackwardApply(Expression, *this);
     return Apply(RHS, LHS, Expression, OpTransList);
   }
   
@@ -338,15 +380,23 @@ namespace backendgen {
 						  const Tree* Exp) const
   {
     OperandTransformationList Result(OpTransList);
-    AnnotatedTreeList *List = MatchExpByRule<false>(Patt1, Exp);
+    AnnotatedTreeList *List;
+    if (Compiled != NULL) {
+      RuleMatcher Matcher = (Patt1 == LHS)? Compiled->ForwardMatch :
+	Compiled->BackwardMatch;
+      List = new AnnotatedTreeList();
+      Matcher(Exp, List);
+    } else
+      List = MatchExpByRule<false>(Patt1, Exp);
     for (OperandTransformationList::iterator I = Result.begin(), 
            E = Result.end(); I != E; ++I) {
       bool Found = false;
       for (AnnotatedTreeList::iterator I2 = List->begin(), E2 = List->end();
            I2 != E2; ++I2) {
 	if (I->LHSOperand == I2->first) {
-	  const Operand* Node = dynamic_cast<const Operand*>(I2->second);
-	  assert (Node != NULL && "OpTransform. rule must refer to operand");	  
+	  assert (I2->second->isOperand() &&
+		  "OpTransform. rule must refer to operand");
+	  const Operand* Node = static_cast<const Operand*>(I2->second);
 	  //BUG: Dangerous! May cause infinite loop
 	  I->TransformExpression = 
 	    I->PatchTransformExpression(Node->getOperandName());	    
@@ -377,7 +427,7 @@ namespace backendgen {
   // otherwise the behaviour is undefined and leaks may occur.
   std::list<Tree*>* SeverTree(Tree* T) {
     if (T->isOperator()) {
-      Operator *O = dynamic_cast<Operator*>(T);
+      Operator *O = static_cast<Operator*>(T);
 
       if (T->getType() == DecompOp) {
 	std::list<Tree*>* Result = new std::list<Tree*>();
@@ -386,7 +436,12 @@ namespace backendgen {
 	  {
 	    std::list<Tree*>* ChildResult = SeverTree((*O)[I]);
 	    if (ChildResult == NULL) {
-	      Result->push_back((*O)[I]);
+	      // Severed trees are owned by the caller, shared ones may not
+	      // be handed out
+	      if ((*O)[I]->isShared())
+		Result->push_back((*O)[I]->clone());
+	      else
+		Result->push_back((*O)[I]);
 	    } else {
 	      Result->merge(*ChildResult);
 	      delete ChildResult;
@@ -431,6 +486,40 @@ namespace backendgen {
     S << ";";
   }
 
+  // Auxiliary to getSignature
+  void AppendSignature(const Tree* T, std::ostream& S) {
+    S << T->getType() << ":" << T->getSize();
+    if (T->isTransferDestination())
+      S << "*";
+    if (T->isOperator()) {
+      const Operator* O = static_cast<const Operator*>(T);
+      S << "(";
+      for (int I = 0, E = O->getArity(); I != E; ++I) {
+	if (I != 0)
+	  S << " ";
+	AppendSignature((*O)[I], S);
+      }
+      S << ")";
+      return;
+    }
+    const Operand* O = static_cast<const Operand*>(T);
+    S << "[" << T->getKind() << " " << O->getOperandName();
+    if (T->getKind() == ConstantNode)
+      S << " " << static_cast<const Constant*>(T)->getConstValue();
+    S << "]";
+  }
+
+  // Patterns with numeric types and sizes, which depend on the order of
+  // definitions in the parsed files
+  std::string Rule::getSignature() const
+  {
+    std::stringstream S;
+    AppendSignature(LHS, S);
+    S << (Equivalence? " <=> " : " => ");
+    AppendSignature(RHS, S);
+    return S.str();
+  }
+
   // TransformationRules member functions
   bool TransformationRules::createRule(Tree* LHS,
 				       Tree* RHS,
@@ -438,6 +527,8 @@ namespace backendgen {
     Rule newRule(LHS, RHS, Equivalence, CurrentRuleNumber++);
 
     Rules.push_back(newRule);
+    ReachabilitySteps = 0;
+    RuleIndexValid = false;
 
     return true;
   }
@@ -449,6 +540,8 @@ namespace backendgen {
     Rule newRule(LHS, RHS, Equivalence, CurrentRuleNumber++, OList);
 
     Rules.push_back(newRule);
+    ReachabilitySteps = 0;
+    RuleIndexValid = false;
 
     return true;
   }
@@ -489,4 +582,261 @@ namespace backendgen {
     return Rules.end();
   }
 
+  // Primary operator types match each other if they are equal or one of
+  // them is 0 (a leaf matches everything). OTHER stands for any type not
+  // found in rules: it only matches 0.
+  inline bool MatchTypes(unsigned T1, unsigned T2, bool IsOther) {
+    if (IsOther)
+      return T2 == 0;
+    return (T1 == T2 || T1 == 0 || T2 == 0);
+  }
+
+  unsigned TransformationRules::getTypeIndex(unsigned Type) const {
+    std::map<unsigned, unsigned>::const_iterator I = TypeIndex.find(Type);
+    if (I == TypeIndex.end())
+      return TypeIndex.size();
+    return I->second;
+  }
+
+  // Computes, for each pair of primary operator types, the least number of
+  // rule applications turning the first into the second. Equivalence rules
+  // may be applied both ways. Searches run in parallel may ask for it at
+  // the same time, so only the first one does the work. Steps is the
+  // largest distance accepted by CanReach.
+  void TransformationRules::BuildReachability(unsigned Steps) {
+    assert (Steps > 0 && "At least one rule application is needed");
+#ifdef PARALLEL_SEARCH
+#pragma omp critical (RuleReachability)
+#endif
+    if (ReachabilitySteps != Steps) {
+      // Rule edges between primary operator types
+      std::vector<std::pair<unsigned, unsigned> > Edges;
+      TypeIndex.clear();
+      for (std::list<Rule>::const_iterator I = Rules.begin(),
+	     E = Rules.end(); I != E; ++I) {
+	unsigned LHSPO = expression::PrimaryOperatorType(I->LHS);
+	unsigned RHSPO = expression::PrimaryOperatorType(I->RHS);
+	Edges.push_back(std::make_pair(LHSPO, RHSPO));
+	if (I->Equivalence)
+	  Edges.push_back(std::make_pair(RHSPO, LHSPO));
+	TypeIndex.insert(std::make_pair(LHSPO, TypeIndex.size()));
+	TypeIndex.insert(std::make_pair(RHSPO, TypeIndex.size()));
+      }
+      const unsigned NumTypes = TypeIndex.size() + 1;
+      const unsigned Other = TypeIndex.size();
+      Distance.assign(NumTypes, std::vector<unsigned>(NumTypes, UINT_MAX));
+      for (std::map<unsigned, unsigned>::const_iterator I = TypeIndex.begin(),
+	     E = TypeIndex.end(); ; ++I) {
+	const bool IsOther = (I == E);
+	const unsigned From = IsOther? 0 : I->first;
+	const unsigned FromIndex = IsOther? Other : I->second;
+	// Rule right hand sides reached so far, and when
+	std::vector<unsigned> Reached(NumTypes, UINT_MAX);
+	std::vector<bool> Frontier(NumTypes, false);
+	for (unsigned K = 0, KE = Edges.size(); K != KE; ++K)
+	  if (MatchTypes(From, Edges[K].first, IsOther))
+	    Frontier[getTypeIndex(Edges[K].second)] = true;
+	for (unsigned Step = 1; ; ++Step) {
+	  bool Changed = false;
+	  for (unsigned T = 0; T != NumTypes; ++T)
+	    if (Frontier[T] && Reached[T] == UINT_MAX) {
+	      Reached[T] = Step;
+	      Changed = true;
+	    }
+	  if (!Changed)
+	    break;
+	  Frontier.assign(NumTypes, false);
+	  for (std::map<unsigned, unsigned>::const_iterator I2 =
+		 TypeIndex.begin(), E2 = TypeIndex.end(); I2 != E2; ++I2) {
+	    if (Reached[I2->second] == UINT_MAX)
+	      continue;
+	    for (unsigned K = 0, KE = Edges.size(); K != KE; ++K)
+	      if (MatchTypes(I2->first, Edges[K].first, false))
+		Frontier[getTypeIndex(Edges[K].second)] = true;
+	  }
+	}
+	// A reached type matches its equals, or everything if it is a leaf
+	std::vector<unsigned>& Row = Distance[FromIndex];
+	for (std::map<unsigned, unsigned>::const_iterator I2 =
+	       TypeIndex.begin(), E2 = TypeIndex.end(); I2 != E2; ++I2) {
+	  const unsigned Step = Reached[I2->second];
+	  if (Step == UINT_MAX)
+	    continue;
+	  if (I2->first != 0) {
+	    if (Step < Row[I2->second])
+	      Row[I2->second] = Step;
+	    continue;
+	  }
+	  for (unsigned T = 0; T != NumTypes; ++T)
+	    if (Step < Row[T])
+	      Row[T] = Step;
+	}
+	if (IsOther)
+	  break;
+      }
+      ReachabilitySteps = Steps;
+    }
+  }
+
+  // Least number of rule applications transforming an expression whose
+  // primary operator type is ExpPO into a semantic whose primary operator
+  // type is InstrPO, or UINT_MAX if there is no such sequence
+  unsigned TransformationRules::getDistance(unsigned ExpPO,
+					    unsigned InstrPO) const {
+    assert (ReachabilitySteps != 0 && "Reachability must be built first");
+    if (ExpPO == InstrPO || ExpPO == 0 || InstrPO == 0)
+      return 0;
+    return Distance[getTypeIndex(ExpPO)][getTypeIndex(InstrPO)];
+  }
+
+  // Tells whether an expression whose primary operator type is ExpPO may
+  // be transformed into a semantic whose primary operator type is InstrPO
+  bool TransformationRules::CanReach(unsigned ExpPO, unsigned InstrPO) const {
+    return getDistance(ExpPO, InstrPO) <= ReachabilitySteps;
+  }
+
+  // Rules are given generated code in the order they were defined,
+  // provided they did not change since genrules was run
+  unsigned TransformationRules::UseCompiledRules(const CompiledRule* Table,
+						 unsigned Size) {
+    unsigned Pos = 0, NumCompiled = 0;
+    for (std::list<Rule>::iterator I = Rules.begin(), E = Rules.end();
+	 I != E; ++I, ++Pos) {
+      I->Compiled = NULL;
+      if (Pos < Size && I->getSignature() == Table[Pos].Signature) {
+	I->Compiled = &Table[Pos];
+	++NumCompiled;
+      }
+    }
+    return NumCompiled;
+  }
+
+  // Auxiliary to BuildRuleIndex: lists the nodes of Pattern in preorder
+  void FlattenPattern(const Tree* Pattern, std::vector<const Tree*>& Nodes) {
+    Nodes.push_back(Pattern);
+    if (!Pattern->isOperator())
+      return;
+    const Operator* O = static_cast<const Operator*>(Pattern);
+    for (int I = 0, E = O->getArity(); I != E; ++I)
+      FlattenPattern((*O)[I], Nodes);
+  }
+
+  void TransformationRules::AddToRuleIndex(const Tree* Pattern,
+					   unsigned Code) {
+    std::vector<const Tree*> Nodes;
+    FlattenPattern(Pattern, Nodes);
+    unsigned Node = 0;
+    for (unsigned I = 0, E = Nodes.size(); I != E; ++I) {
+      unsigned Child;
+      if (Nodes[I]->isOperator()) {
+	const std::pair<unsigned, int> Key
+	  (Nodes[I]->getType(),
+	   static_cast<const Operator*>(Nodes[I])->getArity());
+	std::map<std::pair<unsigned, int>, unsigned>::const_iterator Pos =
+	  RuleIndex[Node].Children.find(Key);
+	if (Pos != RuleIndex[Node].Children.end()) {
+	  Node = Pos->second;
+	  continue;
+	}
+	Child = RuleIndex.size();
+	RuleIndex[Node].Children[Key] = Child;
+      } else {
+	if (RuleIndex[Node].Variable != 0) {
+	  Node = RuleIndex[Node].Variable;
+	  continue;
+	}
+	Child = RuleIndex.size();
+	RuleIndex[Node].Variable = Child;
+      }
+      RuleIndex.push_back(RuleIndexNode());
+      Node = Child;
+    }
+    RuleIndex[Node].Patterns.push_back(Code);
+  }
+
+  // Builds the discrimination tree with the LHS of every rule, and the RHS
+  // of equivalence rules (see ForwardMatch and BackwardMatch).
+  void TransformationRules::BuildRuleIndex() {
+#ifdef PARALLEL_SEARCH
+#pragma omp critical (RuleIndex)
+#endif
+    if (!RuleIndexValid) {
+      RuleIndex.assign(1, RuleIndexNode());
+      RuleOrder.clear();
+      for (std::list<Rule>::const_iterator I = Rules.begin(),
+	     E = Rules.end(); I != E; ++I) {
+	const unsigned Code = RuleOrder.size() * 2;
+	RuleOrder.push_back(&*I);
+	AddToRuleIndex(I->LHS, Code);
+	if (I->Equivalence)
+	  AddToRuleIndex(I->RHS, Code + 1);
+      }
+      RuleIndexValid = true;
+    }
+  }
+
+  // Walks the index along the subtrees in Pending, the last one first.
+  // An operand of the pattern takes a whole subtree, an operator pushes
+  // its children. Pending is restored on return.
+  void TransformationRules::RetrieveFromRuleIndex
+  (unsigned Node, std::vector<const Tree*>& Pending,
+   std::vector<unsigned>& Codes) const {
+    const RuleIndexNode& N = RuleIndex[Node];
+    if (Pending.empty()) {
+      Codes.insert(Codes.end(), N.Patterns.begin(), N.Patterns.end());
+      return;
+    }
+    const Tree* E = Pending.back();
+    Pending.pop_back();
+    if (N.Variable != 0)
+      RetrieveFromRuleIndex(N.Variable, Pending, Codes);
+    if (E->isOperator() && !N.Children.empty()) {
+      const Operator* O = static_cast<const Operator*>(E);
+      const int Arity = O->getArity();
+      for (int I = Arity - 1; I >= 0; --I)
+	Pending.push_back((*O)[I]);
+      std::map<std::pair<unsigned, int>, unsigned>::const_iterator Pos =
+	N.Children.find(std::make_pair(E->getType(), Arity));
+      if (Pos != N.Children.end())
+	RetrieveFromRuleIndex(Pos->second, Pending, Codes);
+      // Wildcard operators (see MatchExpByRule)
+      if (E->getType() != 0 && E->getType() != MemRefOp &&
+	  !E->isTransferDestination()) {
+	Pos = N.Children.find(std::make_pair(0U, Arity));
+	if (Pos != N.Children.end())
+	  RetrieveFromRuleIndex(Pos->second, Pending, Codes);
+      }
+      Pending.resize(Pending.size() - Arity);
+    }
+    Pending.push_back(E);
+  }
+
+  // Gives, in rule order, the rules whose patterns may match Exp. This is
+  // a superset of the matching ones: sizes and operand types are left for
+  // ForwardMatch and BackwardMatch to check.
+  void TransformationRules::getCandidates(const Tree* Exp,
+					  RuleCandidateList& Candidates)
+    const {
+    assert (RuleIndexValid && "Rule index must be built first");
+    std::vector<const Tree*> Pending(1, Exp);
+    std::vector<unsigned> Codes;
+    RetrieveFromRuleIndex(0, Pending, Codes);
+    std::sort(Codes.begin(), Codes.end());
+    Candidates.clear();
+    for (std::vector<unsigned>::const_iterator I = Codes.begin(),
+	   E = Codes.end(); I != E; ++I) {
+      const Rule* R = RuleOrder[*I / 2];
+      if (Candidates.empty() || Candidates.back().R != R) {
+	RuleCandidate C;
+	C.R = R;
+	C.Forward = C.Backward = false;
+	Candidates.push_back(C);
+      }
+      if (*I % 2 == 0)
+	Candidates.back().Forward = true;
+      else
+	Candidates.back().Backward = true;
+    }
+  }
+
 } // end namespace backendgen
@@ -13,6 +13,8 @@
 
 #include "Semantic.h"
 #include <list>
+#include <map>
+#include <vector>
 
 namespace backendgen {  
   // Used to express a binding between a LHS and a RHS operand, and how llvmbe
@@ -37,11 +39,50 @@ namespace backendgen {
   
   typedef std::list<OperandTransformation> OperandTransformationList;
 
+  // Operands of a rule pattern (by name) and the subtrees they match
+  typedef std::pair<std::string,const expression::Tree*> AnnotatedTree;
+  typedef std::list<AnnotatedTree> AnnotatedTreeList;
+
+  // Builds Pattern with its operands replaced by the subtrees bound to
+  // them in List. Unbound operands get fresh names.
+  expression::Tree* InstantiatePattern(const expression::Tree* Pattern,
+				       AnnotatedTreeList* List,
+				       const OperandTransformationList&
+				       OpTransList);
+
+  // Matches Exp with a rule pattern the way rules without generated code
+  // do. Returns the operand bindings, or NULL if Pattern does not match.
+  AnnotatedTreeList* InterpretPattern(const expression::Tree* Pattern,
+				      const expression::Tree* Exp);
+
+  // Tells whether rule pattern node R may match expression node E,
+  // regardless of their children. A rule operand matches E as a whole.
+  bool MatchRuleNode(const expression::Tree* R, const expression::Tree* E);
+
+  struct Rule;
+
+  // Code generated by genrules for a rule, in one direction. A matcher
+  // tells whether the pattern matches an expression and, if List is not
+  // NULL, adds the operand bindings to it (sorted, as MatchExpByRule).
+  // A rewriter does the job of ForwardApply/BackwardApply.
+  typedef bool (*RuleMatcher)(const expression::Tree* Exp,
+			      AnnotatedTreeList* List);
+  typedef expression::Tree* (*RuleRewriter)(const expression::Tree* Exp,
+					    const Rule& R);
+  struct CompiledRule {
+    // Rule::getSignature of the rule the code was generated for
+    const char* Signature;
+    RuleMatcher ForwardMatch, BackwardMatch;
+    RuleRewriter ForwardApply, BackwardApply;
+  };
+
   // A Rule represents a given transformation
   struct Rule {  
     // Number used to generate random names for operands when applying
     // a rule.
     static unsigned OpNum;
+    // Takes a fresh OpNum. Searches may run concurrently.
+    static unsigned NextOpNum() { return __sync_fetch_and_add(&OpNum, 1); }
     // References to left hand side and right hand side expression trees.
     expression::Tree* LHS; 
     expression::Tree* RHS;
@@ -56,6 +97,8 @@ namespace backendgen {
     // If applying the inverse of this rule can be used to decompose
     bool Composition;
     OperandTransformationList OpTransList;
+    // Generated code for this rule, if any (see UseCompiledRules)
+    const CompiledRule* Compiled;
     Rule(expression::Tree* LHS, expression::Tree* RHS, bool Equivalence,
 	 unsigned Id);
     Rule(expression::Tree* LHS, expression::Tree* RHS, bool Equivalence,
@@ -66,6 +109,15 @@ namespace backendgen {
     bool BackwardMatch(const expression::Tree* Expression) const;
     expression::Tree* ForwardApply(const expression::Tree* Expression) const;
     expression::Tree* BackwardApply(const expression::Tree* Expression) const;
+    // Root node of the tree built by ForwardApply/BackwardApply, when it
+    // does not depend on the expression (the result pattern is an
+    // operator). Returns NULL otherwise.
+    const expression::Tree* ForwardApplyRoot() const {
+      return RHS->isOperator()? RHS : NULL;
+    }
+    const expression::Tree* BackwardApplyRoot() const {
+      return LHS->isOperator()? LHS : NULL;
+    }
     OperandTransformationList ApplyGetOpTrans(const expression::Tree* Patt1, 
 				              const expression::Tree* Exp)
 				              const;
@@ -76,10 +128,20 @@ namespace backendgen {
 					      expression::Tree* Exp)
 				              const;
     void Print(std::ostream &S) const;
+    // Everything about the patterns that generated code depends on
+    std::string getSignature() const;
   };
 
   typedef std::list<Rule>::const_iterator RuleIterator;
 
+  // A rule that may apply to an expression. Forward (Backward) tells
+  // whether its LHS (RHS) may match the expression.
+  struct RuleCandidate {
+    const Rule* R;
+    bool Forward, Backward;
+  };
+  typedef std::vector<RuleCandidate> RuleCandidateList;
+
   class TransformationRules {
   public:
     bool createRule(expression::Tree* LHS, expression::Tree* RHS,
@@ -87,15 +149,65 @@ namespace backendgen {
     bool createRule(expression::Tree* LHS, expression::Tree* RHS,
 		    bool Equivalence, OperandTransformationList &OList);
     void print(std::ostream &S);
-    TransformationRules() : CurrentRuleNumber(1) {}
+    TransformationRules() : CurrentRuleNumber(1), ReachabilitySteps(0),
+			    RuleIndexValid(false) {}
     ~TransformationRules();
     RuleIterator getBegin();
     RuleIterator getEnd();
+    // Rules created so far. Rules are never removed, so this tells
+    // whether rules were added since something was built from them.
+    unsigned getNumRules() const { return CurrentRuleNumber - 1; }
+    // Reachability between primary operator types. Built once all rules
+    // are known, it tells whether an expression may become an instruction
+    // semantic after up to Steps rule applications.
+    void BuildReachability(unsigned Steps);
+    bool CanReach(unsigned ExpPO, unsigned InstrPO) const;
+    unsigned getDistance(unsigned ExpPO, unsigned InstrPO) const;
+    // Index of rule patterns. Built once all rules are known, it gives
+    // the rules that may match an expression with a single traversal.
+    void BuildRuleIndex();
+    // Makes rules use the code genrules generated for them. Rules changed
+    // since then keep being interpreted. Returns how many rules use
+    // generated code.
+    unsigned UseCompiledRules(const CompiledRule* Table, unsigned Size);
+    void getCandidates(const expression::Tree* Exp,
+		       RuleCandidateList& Candidates) const;
   private:
     std::list<Rule> Rules;
     unsigned CurrentRuleNumber;
+    // Dense index of each primary operator type found in rules. Other
+    // types share the last index.
+    std::map<unsigned, unsigned> TypeIndex;
+    // Distance[i][j]: rule applications needed for type i to become type j
+    std::vector<std::vector<unsigned> > Distance;
+    unsigned ReachabilitySteps;
+    unsigned getTypeIndex(unsigned Type) const;
+    // Discrimination tree over the preorder nodes of LHS and RHS patterns.
+    // Operators are keyed by type and arity. Rule operands may match whole
+    // subtrees, so they all share the variable key.
+    struct RuleIndexNode {
+      std::map<std::pair<unsigned, int>, unsigned> Children;
+      // Child for operands, 0 if none (the root is never a child)
+      unsigned Variable;
+      // Patterns ending here: rule position * 2, plus 1 for RHS
+      std::vector<unsigned> Patterns;
+      RuleIndexNode() : Variable(0) {}
+    };
+    std::vector<RuleIndexNode> RuleIndex;
+    std::vector<const Rule*> RuleOrder;
+    bool RuleIndexValid;
+    void AddToRuleIndex(const expression::Tree* Pattern, unsigned Code);
+    void RetrieveFromRuleIndex(unsigned Node,
+			       std::vector<const expression::Tree*>& Pending,
+			       std::vector<unsigned>& Codes) const;
   };
 
+#ifdef COMPILED_RULES
+  // Generated by genrules from Parser/rules.txt (see Makefile)
+  extern const CompiledRule CompiledRules[];
+  extern const unsigned NumCompiledRules;
+#endif
+
 
   
 
@@ -627,6 +627,10 @@ operand or memory reference.");
 
   InstrManager::InstrManager() {
     OrderNum = 0;
+    IndexValid = false;
+    BackwardFormsRules = NULL;
+    BackwardFormsNumRules = 0;
+    BackwardFormsValid = false;
   }
   
   InstrManager::~InstrManager() {
@@ -640,6 +644,8 @@ operand or memory reference.");
   void InstrManager::addInstruction (Instruction *Instr) {
     Instructions.push_back(Instr);
     Instr->OrderNum = OrderNum++;
+    IndexValid = false;
+    BackwardFormsValid = false;
   }
   
   Instruction *InstrManager::getInstruction(const std::string &Name,
@@ -709,6 +715,85 @@ operand or memory reference.");
   void InstrManager::SortInstructions() {
     std::stable_sort(Instructions.begin(), Instructions.end(), 
 	      InstructionsComparator());
+    IndexValid = false;
+    BackwardFormsValid = false;
+  }
+
+  // Semantics are indexed by the key of their tree. Each index entry keeps
+  // the semantics in the order they are found in Instructions. Searches
+  // run in parallel may ask for the index at the same time, so it is only
+  // built by the first one.
+  void InstrManager::BuildSemanticIndex() {
+#ifdef PARALLEL_SEARCH
+#pragma omp critical (SemanticIndex)
+#endif
+    if (!IndexValid) {
+      SemanticIndex.clear();
+      unsigned SeqNum = 0;
+      for (InstrIterator I = getBegin(), E = getEnd(); I != E; ++I) {
+	for (SemanticIterator I2 = (*I)->getBegin(), E2 = (*I)->getEnd();
+	     I2 != E2; ++I2) {
+	  SemanticCandidate C;
+	  C.Insn = *I;
+	  C.Sem = I2;
+	  C.SeqNum = SeqNum++;
+	  SemanticIndex[getSemanticKey(I2->SemanticExpression)].push_back(C);
+	}
+      }
+      IndexValid = true;
+    }
+  }
+
+  // Two trees only match (see Compare in the search engine) if they have
+  // the same key
+  SemanticKey InstrManager::getSemanticKey(const Tree* Exp) {
+    while (Exp->isOperator()) {
+      const Operator* O = dynamic_cast<const Operator*>(Exp);
+      if (O->getType() != AssignOp)
+	return std::make_pair(O->getType(), 0U);
+      Exp = (*O)[1];
+    }
+    return std::make_pair(0U, dynamic_cast<const Operand*>(Exp)
+			  ->getDataType());
+  }
+
+  const CandidateList& InstrManager::getCandidates(const SemanticKey& Key)
+    const {
+    static const CandidateList Empty;
+    assert (IndexValid && "Semantic index must be built first");
+    SemanticIndexTy::const_iterator I = SemanticIndex.find(Key);
+    if (I == SemanticIndex.end())
+      return Empty;
+    return I->second;
+  }
+
+  SemanticIndexTy::const_iterator InstrManager::getIndexBegin() const {
+    assert (IndexValid && "Semantic index must be built first");
+    return SemanticIndex.begin();
+  }
+
+  SemanticIndexTy::const_iterator InstrManager::getIndexEnd() const {
+    return SemanticIndex.end();
+  }
+
+  bool InstrManager::hasBackwardForms(const TransformationRules* Rules,
+				      unsigned NumRules) const {
+    return BackwardFormsValid && BackwardFormsRules == Rules &&
+      BackwardFormsNumRules == NumRules;
+  }
+
+  void InstrManager::setBackwardForms(BackwardFormList& Forms,
+				      const TransformationRules* Rules,
+				      unsigned NumRules) {
+    BackwardForms.swap(Forms);
+    BackwardFormsRules = Rules;
+    BackwardFormsNumRules = NumRules;
+    BackwardFormsValid = true;
+  }
+
+  const BackwardFormList& InstrManager::getBackwardForms() const {
+    assert (BackwardFormsValid && "Backward forms must be built first");
+    return BackwardForms;
   }
   
   void InstrManager::SetLLVMNames()
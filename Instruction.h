@@ -18,6 +18,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
 
 using namespace backendgen::expression;
 
@@ -25,6 +26,7 @@ namespace backendgen {
 class FormatField;
 class InsnFormat;
 class Instruction;
+class TransformationRules;
 
 extern const Operand DummyOperand;
 extern const Operand MemRefOperand;
@@ -137,6 +139,40 @@ class Instruction {
 
 typedef std::vector<Instruction*>::const_iterator InstrIterator;
 
+// A semantic tree of an instruction, as recorded in the InstrManager index
+// of semantics. SeqNum is its position when all semantics of all
+// instructions are visited in order, so candidates taken from several
+// index entries may be merged back in this order.
+struct SemanticCandidate {
+  const Instruction* Insn;
+  SemanticIterator Sem;
+  unsigned SeqNum;
+};
+typedef std::vector<SemanticCandidate> CandidateList;
+// Primary operator type (see PrimaryOperatorType) and, when the primary
+// node is a leaf, its data type
+typedef std::pair<unsigned, unsigned> SemanticKey;
+typedef std::map<SemanticKey, CandidateList> SemanticIndexTy;
+
+// A form an instruction semantic takes when equivalence rules are
+// applied to it. Expressions matching Form become the semantic once
+// Rules (RuleIDs) are applied to them, in this order.
+// Forms have the operands of their semantic, but rules may reorder or
+// repeat them. Each leaf of Form and of the semantic that is not a
+// constant, in preorder, is given a slot: the index of its operand name
+// among the NumOperands names of the semantic.
+struct BackwardForm {
+  const Instruction* Insn;
+  SemanticIterator Sem;
+  unsigned SeqNum;
+  // Shared tree
+  const Tree* Form;
+  std::list<unsigned> Rules;
+  unsigned NumOperands;
+  std::vector<unsigned> FormSlots, SemSlots;
+};
+typedef std::vector<BackwardForm> BackwardFormList;
+
 
 // Manages instruction instances.
 class InstrManager {
@@ -151,8 +187,32 @@ class InstrManager {
   InstrIterator getEnd() const;
   void SortInstructions();
   void SetLLVMNames();
+  // Index of instruction semantics, used by the search to visit only
+  // semantics that may implement a given expression. It is built once
+  // all instructions and their semantics are known.
+  void BuildSemanticIndex();
+  static SemanticKey getSemanticKey(const Tree* Exp);
+  const CandidateList& getCandidates(const SemanticKey& Key) const;
+  SemanticIndexTy::const_iterator getIndexBegin() const;
+  SemanticIndexTy::const_iterator getIndexEnd() const;
+  // Backward forms of all semantics (see Search::getBackwardForms). Like
+  // the semantic index, they are dropped when instructions change, and
+  // they are only valid for the rules they were built with: Rules when
+  // it had NumRules rules.
+  bool hasBackwardForms(const TransformationRules* Rules,
+			unsigned NumRules) const;
+  // Takes the contents of Forms
+  void setBackwardForms(BackwardFormList& Forms,
+			const TransformationRules* Rules, unsigned NumRules);
+  const BackwardFormList& getBackwardForms() const;
  private:
   std::vector<Instruction*> Instructions;
+  SemanticIndexTy SemanticIndex;
+  bool IndexValid;
+  BackwardFormList BackwardForms;
+  const TransformationRules* BackwardFormsRules;
+  unsigned BackwardFormsNumRules;
+  bool BackwardFormsValid;
   unsigned OrderNum; // Order of appearance in archc isa file for current ins
 };
 
@@ -152,7 +152,10 @@ translate:         TRANSLATE exp SEMICOLON
 			     //  std::cout << *I2 << " ";
 			     //}
 			     //std::cout << "\n";
-			     I->first->emitAssembly(**I1, I->second, std::cout);
+			     I->first->emitAssembly(std::list<std::string>
+						    ((*I1)->begin(),
+						     (*I1)->end()),
+						    I->second, std::cout);
 			     ++I1;
 			     //(I->first)->print(std::cout);
 			   }
@@ -0,0 +1,92 @@
+//===- bidir.cpp  - Bidirectional search test program     --*- C++ -*------===//
+//
+//              The ArchC Project - Compiler Backend Generation
+//
+//===----------------------------------------------------------------------===//
+//
+// Test program for the bidirectional search. Parses the file given as
+// first argument, creating the instructions named by the other
+// arguments, and prints the instructions and operand definitions found
+// for each pattern by a search of depth 1. Run on backward.txt and
+// compared to backward.expected by "make check".
+//
+//===----------------------------------------------------------------------===//
+
+#include "../InsnSelector/TransformationRules.h"
+#include "../InsnSelector/Semantic.h"
+#include "../InsnSelector/Search.h"
+#include "../Instruction.h"
+#include "../Support.h"
+
+#include <cstdio>
+
+using namespace backendgen;
+using namespace backendgen::expression;
+
+extern TransformationRules RuleManager;
+extern InstrManager InstructionManager;
+extern PatternManager PatMan;
+extern FILE *yybein;
+extern bool HasError;
+
+int yybeparse();
+
+class UpdateSizeFunctor {
+public:
+  bool operator() (Tree* Element) {
+    Operand* O = dynamic_cast<Operand *>(Element);
+    O->updateSize();
+    return true;
+  }
+};
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " file [instruction ...]\n";
+    return 1;
+  }
+  for (int I = 2; I != argc; ++I) {
+    Instruction* Insn = new Instruction(argv[I], "%reg, %reg, %reg", NULL,
+					argv[I]);
+    Insn->setLLVMName(argv[I]);
+    InstructionManager.addInstruction(Insn);
+  }
+
+  yybein = fopen(argv[1], "r");
+  if (yybein == NULL) {
+    std::cerr << "Could not open " << argv[1] << ".\n";
+    return 1;
+  }
+  int ret = yybeparse();
+  fclose(yybein);
+  if (ret || HasError)
+    return 1;
+
+  for (PatternManager::Iterator P = PatMan.begin(), PE = PatMan.end();
+       P != PE; ++P) {
+    Tree* Exp = const_cast<Tree*>(P->TargetImpl);
+    ApplyToLeafs<Tree*,Operator*,UpdateSizeFunctor>(Exp, UpdateSizeFunctor());
+    Search S(RuleManager, InstructionManager);
+    S.setStrategy(BidirectionalStrategy);
+    S.setMaxDepth(1);
+    SearchResult* R = S(Exp, 0, NULL);
+    std::cout << P->Name << ":";
+    if (R->Instructions->empty()) {
+      std::cout << " not implemented\n";
+    } else {
+      OperandsDefsType::const_iterator D = R->OperandsDefs->begin();
+      for (InstrList::const_iterator I = R->Instructions->begin(),
+	     E = R->Instructions->end(); I != E; ++I, ++D) {
+	std::cout << " " << I->first->getName();
+	for (NameListType::const_iterator N = (*D)->begin(),
+	       NE = (*D)->end(); N != NE; ++N)
+	  std::cout << " " << N->str();
+      }
+      std::cout << "\n";
+    }
+    delete R;
+  }
+  return 0;
+}
@@ -0,0 +1,160 @@
+//===- cachecheck.cpp - Dead ends persistence test program  --*- C++ -*-----===//
+//
+//              The ArchC Project - Compiler Backend Generation
+//
+//===----------------------------------------------------------------------===//
+//
+// Test program for the dead ends saved between runs (see
+// TransformationCache::Save and Load). Parses the file given as first
+// argument, creating the instructions named by the arguments after the
+// second, and searches every pattern twice. Dead ends the first pass
+// proves are saved to the file given as second argument; all dead ends
+// are then forgotten and loaded back from it. The second pass must find
+// the same instructions, hit the cache more often than the first, and save
+// the very same dead ends. Prints the instructions found for each pattern.
+// Run on backward.txt by "make check".
+//
+//===----------------------------------------------------------------------===//
+
+#include "../InsnSelector/TransformationRules.h"
+#include "../InsnSelector/Semantic.h"
+#include "../InsnSelector/Search.h"
+#include "../Instruction.h"
+#include "../Support.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+using namespace backendgen;
+using namespace backendgen::expression;
+
+extern TransformationRules RuleManager;
+extern InstrManager InstructionManager;
+extern PatternManager PatMan;
+extern FILE *yybein;
+extern bool HasError;
+
+int yybeparse();
+
+// Depth of the searches, deep enough for them to prove dead ends
+#define CHECK_DEPTH 3
+
+class UpdateSizeFunctor {
+public:
+  bool operator() (Tree* Element) {
+    Operand* O = dynamic_cast<Operand *>(Element);
+    O->updateSize();
+    return true;
+  }
+};
+
+// Reads the lines of FileName, sorted, as dead ends are saved in no
+// particular order
+std::vector<std::string> ReadSorted(const char *FileName) {
+  std::vector<std::string> Lines;
+  std::ifstream File(FileName);
+  std::string Line;
+  while (std::getline(File, Line))
+    Lines.push_back(Line);
+  std::sort(Lines.begin(), Lines.end());
+  return Lines;
+}
+
+// Searches every pattern, appending the instructions found to Results and
+// returning the number of cache hits
+unsigned long long SearchPatterns(std::vector<std::string>& Results) {
+  unsigned long long CacheHits = 0;
+  for (PatternManager::Iterator P = PatMan.begin(), PE = PatMan.end();
+       P != PE; ++P) {
+    Tree* Exp = const_cast<Tree*>(P->TargetImpl);
+    Search S(RuleManager, InstructionManager);
+    S.setMaxDepth(CHECK_DEPTH);
+    SearchResult* R = S(Exp, 0, NULL);
+    CacheHits += S.getStats().CacheHits;
+    std::string Result = P->Name + ":";
+    if (R->Instructions->empty())
+      Result += " not implemented";
+    for (InstrList::const_iterator I = R->Instructions->begin(),
+	   E = R->Instructions->end(); I != E; ++I)
+      Result += " " + I->first->getName();
+    Results.push_back(Result);
+    delete R;
+  }
+  return CacheHits;
+}
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+	      << " file cachefile [instruction ...]\n";
+    return 1;
+  }
+  for (int I = 3; I != argc; ++I) {
+    Instruction* Insn = new Instruction(argv[I], "%reg, %reg, %reg", NULL,
+					argv[I]);
+    Insn->setLLVMName(argv[I]);
+    InstructionManager.addInstruction(Insn);
+  }
+
+  yybein = fopen(argv[1], "r");
+  if (yybein == NULL) {
+    std::cerr << "Could not open " << argv[1] << ".\n";
+    return 1;
+  }
+  int ret = yybeparse();
+  fclose(yybein);
+  if (ret || HasError)
+    return 1;
+  for (PatternManager::Iterator P = PatMan.begin(), PE = PatMan.end();
+       P != PE; ++P) {
+    Tree* Exp = const_cast<Tree*>(P->TargetImpl);
+    ApplyToLeafs<Tree*,Operator*,UpdateSizeFunctor>(Exp, UpdateSizeFunctor());
+  }
+
+  const char *CacheFile = argv[2];
+  std::vector<std::string> First, Second;
+  const unsigned long long FirstHits = SearchPatterns(First);
+  if (!Search::SaveTransCache(CacheFile, 0, DepthFirstStrategy)) {
+    std::cerr << "Could not save dead ends to " << CacheFile << ".\n";
+    return 1;
+  }
+  const std::vector<std::string> Saved = ReadSorted(CacheFile);
+  Search::ClearCaches();
+  if (!Search::LoadTransCache(CacheFile, 0, DepthFirstStrategy)) {
+    std::cerr << "Could not load dead ends from " << CacheFile << ".\n";
+    return 1;
+  }
+  const unsigned long long SecondHits = SearchPatterns(Second);
+  for (unsigned I = 0, E = First.size(); I != E; ++I)
+    std::cout << First[I] << "\n";
+
+  if (Second != First) {
+    std::cerr << "Searches using the loaded dead ends found other"
+	      << " instructions.\n";
+    return 1;
+  }
+  // Dead ends follow the VERSION and CONFIG lines
+  if (Saved.size() <= 2) {
+    std::cerr << "No dead ends were proven.\n";
+    return 1;
+  }
+  if (SecondHits <= FirstHits) {
+    std::cerr << "Dead ends loaded from " << CacheFile
+	      << " were not used.\n";
+    return 1;
+  }
+  if (!Search::SaveTransCache(CacheFile, 0, DepthFirstStrategy)) {
+    std::cerr << "Could not save dead ends to " << CacheFile << ".\n";
+    return 1;
+  }
+  if (ReadSorted(CacheFile) != Saved) {
+    std::cerr << "Dead ends saved to " << CacheFile
+	      << " differ from the ones loaded.\n";
+    return 1;
+  }
+  return 0;
+}
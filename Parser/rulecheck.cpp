@@ -0,0 +1,176 @@
+//===- rulecheck.cpp - Rule matching test program           --*- C++ -*-----===//
+//
+//              The ArchC Project - Compiler Backend Generation
+//
+//===----------------------------------------------------------------------===//
+//
+// Test program for the ways rules are matched. Parses the rules file given
+// as argument, the one CompiledRules.cpp was generated from by genrules,
+// and matches every rule, in each direction, with every subtree of the
+// rule patterns and of the patterns in the file, and with these subtrees
+// rewritten once by each rule that applies. For each of them:
+// - the matcher genrules generated must agree with MatchExpByRule, both
+//   on whether it matches and on the operand bindings;
+// - getCandidates must return the rule, for that direction, whenever
+//   MatchExpByRule matches.
+// Run by "make check".
+//
+//===----------------------------------------------------------------------===//
+
+#include "../InsnSelector/TransformationRules.h"
+#include "../InsnSelector/Semantic.h"
+#include "../Support.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace backendgen;
+using namespace backendgen::expression;
+
+extern TransformationRules RuleManager;
+extern PatternManager PatMan;
+extern FILE *yybein;
+extern bool HasError;
+
+int yybeparse();
+
+class UpdateSizeFunctor {
+public:
+  bool operator() (Tree* Element) {
+    Operand* O = dynamic_cast<Operand *>(Element);
+    O->updateSize();
+    return true;
+  }
+};
+
+// Adds Exp and all its subtrees to Expressions
+void CollectSubtrees(const Tree* Exp, std::vector<const Tree*>& Expressions) {
+  Expressions.push_back(Exp);
+  if (!Exp->isOperator())
+    return;
+  const Operator* O = static_cast<const Operator*>(Exp);
+  for (int I = 0, E = O->getArity(); I != E; ++I)
+    CollectSubtrees((*O)[I], Expressions);
+}
+
+// Tells whether both lists bind the same operands to the same subtrees, in
+// the same order
+bool SameBindings(const AnnotatedTreeList& A, const AnnotatedTreeList& B) {
+  if (A.size() != B.size())
+    return false;
+  for (AnnotatedTreeList::const_iterator I = A.begin(), E = A.end(),
+	 I2 = B.begin(); I != E; ++I, ++I2)
+    if (I->first != I2->first || I->second != I2->second)
+      return false;
+  return true;
+}
+
+// Checks one rule in one direction against Exp. Returns the number of
+// errors found.
+unsigned CheckMatch(const Rule& R, bool Forward, RuleMatcher Compiled,
+		    const RuleCandidateList& Candidates, const Tree* Exp) {
+  const Tree* Pattern = Forward? R.LHS : R.RHS;
+  AnnotatedTreeList* Interpreted = InterpretPattern(Pattern, Exp);
+  AnnotatedTreeList Generated;
+  const bool GeneratedMatch = Compiled(Exp, &Generated);
+  unsigned Errors = 0;
+  const char* Error = NULL;
+  if ((Interpreted != NULL) != GeneratedMatch)
+    Error = "generated matcher disagrees with MatchExpByRule on";
+  else if (Interpreted != NULL && !SameBindings(*Interpreted, Generated))
+    Error = "generated matcher binds other operands than MatchExpByRule in";
+  if (Error != NULL) {
+    std::cout << "Rule " << R.RuleID << (Forward? " forward: " :
+					 " backward: ")
+	      << Error << " ";
+    Exp->print(std::cout);
+    std::cout << "\n";
+    ++Errors;
+  }
+  if (Interpreted != NULL) {
+    bool Found = false;
+    for (RuleCandidateList::const_iterator I = Candidates.begin(),
+	   E = Candidates.end(); I != E; ++I)
+      if (I->R == &R && (Forward? I->Forward : I->Backward))
+	Found = true;
+    if (!Found) {
+      std::cout << "Rule " << R.RuleID << (Forward? " forward: " :
+					   " backward: ")
+		<< "missing from the candidates of ";
+      Exp->print(std::cout);
+      std::cout << "\n";
+      ++Errors;
+    }
+  }
+  delete Interpreted;
+  return Errors;
+}
+
+int
+main(int argc, char **argv)
+{
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " rulesfile\n";
+    return 1;
+  }
+  yybein = fopen(argv[1], "r");
+  if (yybein == NULL) {
+    std::cerr << "Could not open " << argv[1] << ".\n";
+    return 1;
+  }
+  int ret = yybeparse();
+  fclose(yybein);
+  if (ret || HasError)
+    return 1;
+
+  unsigned Pos = 0;
+  for (RuleIterator I = RuleManager.getBegin(), E = RuleManager.getEnd();
+       I != E; ++I, ++Pos)
+    if (Pos >= NumCompiledRules ||
+	I->getSignature() != CompiledRules[Pos].Signature) {
+      std::cerr << "Rule " << I->RuleID << " changed since genrules was run."
+		<< " Please rebuild.\n";
+      return 1;
+    }
+  RuleManager.BuildRuleIndex();
+
+  std::vector<const Tree*> Expressions;
+  for (RuleIterator I = RuleManager.getBegin(), E = RuleManager.getEnd();
+       I != E; ++I) {
+    CollectSubtrees(I->LHS, Expressions);
+    CollectSubtrees(I->RHS, Expressions);
+  }
+  for (PatternManager::Iterator P = PatMan.begin(), PE = PatMan.end();
+       P != PE; ++P) {
+    Tree* Exp = const_cast<Tree*>(P->TargetImpl);
+    ApplyToLeafs<Tree*,Operator*,UpdateSizeFunctor>(Exp, UpdateSizeFunctor());
+    CollectSubtrees(Exp, Expressions);
+  }
+  // Rewritten trees are not freed: they may share nodes
+  for (unsigned I = 0, E = Expressions.size(); I != E; ++I)
+    for (RuleIterator R = RuleManager.getBegin(), RE = RuleManager.getEnd();
+	 R != RE; ++R) {
+      if (R->ForwardMatch(Expressions[I]))
+	CollectSubtrees(R->ForwardApply(Expressions[I]), Expressions);
+      if (R->BackwardMatch(Expressions[I]))
+	CollectSubtrees(R->BackwardApply(Expressions[I]), Expressions);
+    }
+
+  unsigned Errors = 0;
+  for (unsigned I = 0, E = Expressions.size(); I != E; ++I) {
+    RuleCandidateList Candidates;
+    RuleManager.getCandidates(Expressions[I], Candidates);
+    Pos = 0;
+    for (RuleIterator R = RuleManager.getBegin(), RE = RuleManager.getEnd();
+	 R != RE; ++R, ++Pos) {
+      Errors += CheckMatch(*R, true, CompiledRules[Pos].ForwardMatch,
+			   Candidates, Expressions[I]);
+      if (R->Equivalence)
+	Errors += CheckMatch(*R, false, CompiledRules[Pos].BackwardMatch,
+			     Candidates, Expressions[I]);
+    }
+  }
+  std::cout << Expressions.size() << " expressions checked, " << Errors
+	    << " error(s).\n";
+  return Errors == 0? 0 : 1;
+}
@@ -1717,7 +1717,7 @@ inline bool ReachedRoot(InstrList* L, InstrList::iterator I) {
 
 struct NoDefException{};
 
-inline const std::string& ExtractDefOperandName(NameListType* OpNames, 
+inline std::string ExtractDefOperandName(NameListType* OpNames, 
 					 CnstOperandsList* AllOps,
 					 const Operand* DefOperand) {
   NameListType::const_iterator NI = OpNames->begin();
@@ -148,8 +148,7 @@ SearchResult* SaveAgent::LoadRecord(const string &Name) {
   SearchResult *SR = new SearchResult();
   
   //Load instruction list
-  InstrList* Instructions = new InstrList();
-  SR->Instructions = Instructions;
+  InstrList* Instructions = SR->Instructions;
   while (File >> buf1 >> buf4) {
     if (!buf1.compare("ENDOFSTREAM"))
       break;
@@ -180,8 +179,7 @@ SearchResult* SaveAgent::LoadRecord(const string &Name) {
   SR->Cost = Cost;
   
   //Loading OperandsDefs
-  OperandsDefsType *OperandsDefs = new OperandsDefsType();
-  SR->OperandsDefs = OperandsDefs;
+  OperandsDefsType *OperandsDefs = SR->OperandsDefs;
   NameListType *NL = new NameListType();
   while (File >> buf1) {
     if (!buf1.compare(";")) {
@@ -203,8 +201,7 @@ SearchResult* SaveAgent::LoadRecord(const string &Name) {
   }
   
   // Loading RulesApplied
-  RulesAppliedList *RulesApplied = new RulesAppliedList();
-  SR->RulesApplied = RulesApplied;
+  RulesAppliedList *RulesApplied = SR->RulesApplied;
   while (File >> buf4) {
     if (buf4 == 999999)
       break;
@@ -213,8 +210,7 @@ SearchResult* SaveAgent::LoadRecord(const string &Name) {
   File.ignore(std::numeric_limits<int>::max(), '\n');
   
   // Loading OpTrans
-  OpTransLists *OpTrans = new OpTransLists();
-  SR->OpTrans = OpTrans;
+  OpTransLists *OpTrans = SR->OpTrans;
   OperandTransformationList OTL = OperandTransformationList();
   while (File >> buf1 >> buf2) {
     if (!buf1.compare(";")) {
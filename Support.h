@@ -12,6 +12,16 @@
 #include <cstdlib>
 #include <cassert>
 #include <sstream>
+#include <new>
+#include <sys/time.h>
+
+// Recycling pools keep one free list per thread when the search runs in
+// parallel, so no locking is needed.
+#ifdef PARALLEL_SEARCH
+#define POOL_THREAD_LOCAL __thread
+#else
+#define POOL_THREAD_LOCAL
+#endif
 
 namespace backendgen {
 
@@ -32,6 +42,13 @@ inline void AbortOn(const std::string &S) {
   std::abort();
 }
   
+// Wall clock time, in seconds
+inline double WallTime() {
+  struct timeval TV;
+  gettimeofday(&TV, NULL);
+  return TV.tv_sec + TV.tv_usec / 1e6;
+}
+
 inline void generateIdent(std::ostream& O, unsigned ident) {
   for (unsigned i = 0; i < ident; ++i)
     O << " ";
@@ -50,8 +67,8 @@ bool ApplyToLeafs(T root, Function f) {
   while (Queue.size() > 0) {
     T Element = Queue.front();
     Queue.pop_front();
-    OP Op = dynamic_cast<OP>(Element);
-    if (Op != NULL) {
+    if (Element->isOperator()) {
+      OP Op = static_cast<OP>(Element);
       for (int I = 0, E = Op->getArity(); I != E; ++I) {
 	Queue.push_back((*Op)[I]);
       }
@@ -77,8 +94,8 @@ bool ApplyToAllNodes(T root, Function f) {
     Queue.pop_front();
     if (Element == NULL)
       continue;
-    OP Op = dynamic_cast<OP>(Element);
-    if (Op != NULL) {
+    if (Element->isOperator()) {
+      OP Op = static_cast<OP>(Element);
       ReturnOk = ReturnOk && f(Element);
       for (int I = 0, E = Op->getArity(); I != E; ++I) {
 	Queue.push_back((*Op)[I]);
@@ -111,7 +128,7 @@ inline unsigned ExtractOperandNumber(const std::string& OpName) {
 inline bool HasOperandNumber(const expression::Operand* Op) {
   if (Op->isSpecificReference())
     return false;
-  if (dynamic_cast<const expression::Constant*>(Op))
+  if (Op->getKind() == expression::ConstantNode)
     return false;
   const std::string& OpName = Op->getOperandName();
   std::string::size_type idx;
@@ -169,6 +186,48 @@ inline std::string InferValueType(const expression::OperandType *O) {
   return std::string("**UNKNOWN**");
 }
 
+// Recycling allocator for objects of type T that are created and destroyed
+// at a high rate. Released blocks are kept in a free list and handed back
+// by later allocations instead of going through malloc. trim() gives all
+// recycled blocks back to the system.
+template<class T>
+class RecyclingPool {
+  struct FreeBlock {
+    FreeBlock *Next;
+  };
+  static POOL_THREAD_LOCAL FreeBlock *FreeList;
+public:
+  static void* allocate(size_t Size) {
+    assert(Size == sizeof(T) && "Pool used with a different type");
+    if (FreeList == NULL)
+      return ::operator new(sizeof(T) < sizeof(FreeBlock) ?
+			    sizeof(FreeBlock) : sizeof(T));
+    FreeBlock *Block = FreeList;
+    FreeList = Block->Next;
+    return Block;
+  }
+  static void release(void *P) {
+    if (P == NULL)
+      return;
+    FreeBlock *Block = static_cast<FreeBlock*>(P);
+    Block->Next = FreeList;
+    FreeList = Block;
+  }
+  // Whether the next allocation has to go to the system
+  static bool isEmpty() { return FreeList == NULL; }
+  static void trim() {
+    while (FreeList != NULL) {
+      FreeBlock *Next = FreeList->Next;
+      ::operator delete(FreeList);
+      FreeList = Next;
+    }
+  }
+};
+
+template<class T>
+POOL_THREAD_LOCAL typename RecyclingPool<T>::FreeBlock*
+RecyclingPool<T>::FreeList = NULL;
+
 
 }
 
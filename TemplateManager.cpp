@@ -12,8 +12,10 @@
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
+#include <cstdio>
 #include <cassert>
 #include <ctime>
+#include <vector>
 #ifdef PARALLEL_SEARCH
 #include <omp.h>
 #endif
@@ -21,6 +23,8 @@
 #define INITIAL_DEPTH 5
 #define SEARCH_DEPTH 25
 #define SEARCH_STEP 3
+// Times a search that ran out of budget is retried with twice the budget
+#define SEARCH_RETRIES 2
 
 using namespace backendgen;
 using namespace backendgen::expression;
@@ -657,12 +661,48 @@ SearchResult* TemplateManager::FindImplementation(const expression::Tree *Exp,
 						  std::ostream &Log,
 						  int TID = 0,
 						  unsigned MaxDepth = 
-						  SEARCH_DEPTH) {
+						  SEARCH_DEPTH,
+						  SearchStatus *Status = NULL,
+						  SearchStats *Stats = NULL) {
   Search S(RuleManager, InstructionManager);
   unsigned SearchDepth = INITIAL_DEPTH;
   SearchResult *R = NULL;
+  SearchStatus LastStatus = SearchDepthLimited;
+  double Seconds = SearchSeconds;
+  unsigned long long Nodes = SearchNodes;
+  unsigned Retries = 0;
   Tree* _Exp = const_cast<Tree*>(Exp);
   ApplyToLeafs<Tree*,Operator*,UpdateSizeFunctor>(_Exp, UpdateSizeFunctor());
+  S.setBudget(Seconds, Nodes);
+#ifdef BEST_FIRST_SEARCH
+  // Best-first search deepens by itself, up to the deepest level the
+  // increasing depth loop would try
+  if (SearchDepth < MaxDepth) {
+    while (SearchDepth + SEARCH_STEP < MaxDepth)
+      SearchDepth = SearchDepth + SEARCH_STEP;
+    S.setStrategy(PatternStrategy == DepthFirstStrategy? BestFirstStrategy :
+		  PatternStrategy, INITIAL_DEPTH, SEARCH_STEP);
+    S.setMaxDepth(SearchDepth);
+    while (true) {
+      if (TID != 0)
+	Log << "Thread " << TID << ": ";
+      Log << "  Trying best-first search with depth " << SearchDepth << "\n";
+      if (R != NULL)
+	delete R;
+      R = S(Exp, 0, NULL);
+      LastStatus = S.getStatus(R);
+      if (LastStatus != SearchOutOfBudget || Retries == SEARCH_RETRIES)
+	break;
+      // Dead ends proved so far are kept, the search resumes quickly
+      ++Retries;
+      Seconds *= 2;
+      Nodes *= 2;
+      Log << "  Search budget exhausted, retrying with twice the budget\n";
+      S.setBudget(Seconds, Nodes);
+    }
+  }
+#else
+  S.setStrategy(PatternStrategy);
   // Increasing search depth loop - first try with low depth to speed up
   // easy matches
   while (R == NULL || R->Instructions->size() == 0) {
@@ -676,13 +716,39 @@ SearchResult* TemplateManager::FindImplementation(const expression::Tree *Exp,
     if (R != NULL)
       delete R;
     R = S(Exp, 0, NULL);
+    LastStatus = S.getStatus(R);
+    // A failure the depth limit played no part in is final
+    if (LastStatus == SearchImpossible)
+      break;
+    if (LastStatus == SearchOutOfBudget) {
+      if (Retries == SEARCH_RETRIES)
+	break;
+      // Retry at the same depth. Dead ends proved so far are kept, the
+      // search resumes quickly.
+      ++Retries;
+      Seconds *= 2;
+      Nodes *= 2;
+      Log << "  Search budget exhausted, retrying with twice the budget\n";
+      S.setBudget(Seconds, Nodes);
+      SearchDepth = SearchDepth - SEARCH_STEP;
+    }
   }
+#endif
+  if (Status != NULL)
+    *Status = LastStatus;
+  if (Stats != NULL)
+    *Stats = S.getStats();
   // Detecting failures
   if (R == NULL) {
     Log << "  Not found!\n";
     return NULL;
   } else if (R->Instructions->size() == 0) {
-    Log << "  Not found!\n";
+    if (LastStatus == SearchOutOfBudget)
+      Log << "  Not found within the search budget!\n";
+    else if (LastStatus == SearchImpossible)
+      Log << "  Not found: no implementation exists with these rules!\n";
+    else
+      Log << "  Not found!\n";
     delete R;
     return NULL;
   }
@@ -1481,7 +1547,7 @@ string TemplateManager::generateGlobalImmBeforePc() {
     NameListType* OpNames = *(OI++);
     for (NameListType::const_iterator NI = OpNames->begin(), 
 	   NE = OpNames->end(); NI != NE; ++NI) {
-      if ((*NI).substr(0,4) == "addr") {
+      if (NI->str().substr(0,4) == "addr") {
 	// Imm appears first.
 	imm = true;      
       }
@@ -1588,6 +1654,113 @@ string TemplateManager::generateReturnLowering() {
   return SS.str();
 }
 
+// Search times of patterns, as measured by previous runs, are kept in a
+// file with a line per pattern: its name and how many seconds it took.
+static void LoadPatternTimes(const string &FileName,
+			     map<string, double> &Times) {
+  std::ifstream File(FileName.c_str());
+  string Name;
+  double Seconds;
+  while (File >> Name >> Seconds)
+    Times[Name] = Seconds;
+}
+
+static bool SavePatternTimes(const string &FileName,
+			     const map<string, double> &Times) {
+  std::ofstream File(FileName.c_str(), std::ios::out | std::ios::trunc);
+  for (map<string, double>::const_iterator I = Times.begin(),
+	 E = Times.end(); I != E; ++I)
+    File << I->first << " " << I->second << "\n";
+  return File.good();
+}
+
+// Returns Text as a JSON string literal
+static string QuoteJSON(const string &Text) {
+  string Result("\"");
+  for (string::const_iterator I = Text.begin(), E = Text.end(); I != E; ++I) {
+    if (*I == '"' || *I == '\\')
+      Result += '\\';
+    if (static_cast<unsigned char>(*I) < 0x20) {
+      char Escape[8];
+      sprintf(Escape, "\\u%04x", static_cast<unsigned char>(*I));
+      Result += Escape;
+    } else
+      Result += *I;
+  }
+  return Result + "\"";
+}
+
+// Writes the work done by the search of each pattern, and its total, as
+// JSON. Patterns recovered from cache were not searched, and patterns with
+// no result are not implemented.
+static bool SaveSearchStats(const string &FileName,
+			    const std::vector<PatternManager::Iterator> &Patterns,
+			    const std::vector<SearchResult*> &Results,
+			    const std::vector<bool> &CacheHits,
+			    const std::vector<SearchStatus> &Statuses,
+			    const std::vector<SearchStats> &Stats) {
+  std::ofstream File(FileName.c_str(), std::ios::out | std::ios::trunc);
+  SearchStats Total;
+  unsigned Failed = 0;
+  File << "{\n  \"patterns\": [";
+  for (unsigned i = 0; i < Patterns.size(); ++i) {
+    if (Results[i] == NULL)
+      ++Failed;
+    File << (i == 0? "\n" : ",\n") << "    {\"name\": "
+	 << QuoteJSON(Patterns[i]->Name) << ", \"cached\": "
+	 << (CacheHits[i]? "true" : "false") << ", \"implemented\": "
+	 << (Results[i] != NULL? "true" : "false");
+    if (!CacheHits[i]) {
+      File << ", \"status\": \"" << getStatusName(Statuses[i])
+	   << "\", \"search\": ";
+      Stats[i].PrintJSON(File);
+      Total.Merge(Stats[i]);
+    }
+    File << "}";
+  }
+  File << "\n  ],\n  \"failed\": " << Failed << ",\n  \"total\": ";
+  Total.PrintJSON(File);
+  File << "\n}\n";
+  return File.good();
+}
+
+// Built-in patterns are required by the rest of the backend generation,
+// which cannot do without them.
+static bool isBuiltInPattern(const string &Name) {
+  static const char *BuiltIns[] = {
+    "STOREFI", "LOADFI", "CONST16", "CONST32", "STOREADD", "LOADADD",
+    "ADDCONST", "ADD", "SUBCONST", "SUB", "FRAMEINDEX", "STOREADDCONST",
+    "LOADADDCONST", "BR", "BRCOND", "BRCOND2", "BRCOND3", "BRCOND4",
+    "BRCOND5", "BRCOND6", "BRCOND7", "BRCOND8", "BRCOND9", "BRCOND10",
+    "GLOBALADDRESS"
+  };
+  for (unsigned i = 0; i < sizeof(BuiltIns) / sizeof(BuiltIns[0]); ++i)
+    if (Name == BuiltIns[i])
+      return true;
+  return false;
+}
+
+// Our binary predicate to sort patterns by decreasing search time.
+// Patterns with no known time come first.
+class LongestFirst {
+  const std::vector<PatternManager::Iterator> &Patterns;
+  const map<string, double> &Times;
+  double getTime(unsigned i) const {
+    map<string, double>::const_iterator I = Times.find(Patterns[i]->Name);
+    return I == Times.end()? -1.0 : I->second;
+  }
+public:
+  LongestFirst(const std::vector<PatternManager::Iterator> &Patterns,
+	       const map<string, double> &Times):
+    Patterns(Patterns), Times(Times) {}
+  bool operator() (unsigned A, unsigned B) const {
+    const double TA = getTime(A), TB = getTime(B);
+    if (TA < 0 || TB < 0)
+      return TA < 0 && TB >= 0;
+    return TA > TB;
+  }
+};
+
 // Here we must find the implementation of several simple patterns. For that
 // we use the search algorithm.
 void TemplateManager::generateSimplePatterns(std::ostream &Log, 					     
@@ -1606,53 +1779,106 @@ void TemplateManager::generateSimplePatterns(std::ostream &Log,
     Cache.ClearFileAndSetVersion(Version);
     invalidCache = true;
   }
+  // Dead ends proved by previous runs are only valid for the very same
+  // model, rules and search configuration, so this cache is never forced.
+  const string TransCacheFile("transcache.file");
+  if (Search::LoadTransCache(TransCacheFile, Version, PatternStrategy))
+    Log << "Known dead ends recovered from " << TransCacheFile << ".\n";
+  // Cached patterns are recovered first. Each pattern logs to its own
+  // buffer, so logs come out in pattern order whatever the schedule.
+  const unsigned NumPatterns = PatMan.size();
+  std::vector<PatternManager::Iterator> Patterns;
+  std::vector<SearchResult*> Results(NumPatterns,
+				     static_cast<SearchResult*>(NULL));
+  std::vector<bool> CacheHits(NumPatterns, false);
+  std::vector<SearchStatus> Statuses(NumPatterns, SearchFound);
+  std::vector<SearchStats> Stats(NumPatterns);
+  std::vector<stringstream*> Logs;
+  std::vector<unsigned> ToSearch;
+  for (unsigned i = 0; i < NumPatterns; ++i) {
+    PatternManager::Iterator I = PatMan.getElementAt(i);
+    Patterns.push_back(I);
+    Logs.push_back(new stringstream());
+    *Logs[i] << "Now finding implementation for : " << I->Name << "\n";
+    Results[i] = invalidCache? NULL : Cache.LoadRecord(I->Name);
+    if (Results[i] != NULL) {
+      CacheHits[i] = true;
+      *Logs[i] << "Recovered from cache.\n";
+      Results[i]->DumpResults(*Logs[i]);
+    } else
+      ToSearch.push_back(i);
+  }
+
+  // Patterns that took longest in previous runs are searched first, so
+  // that none is left running alone at the end. Unknown ones go first.
+  const string TimesFile("patterntimes.file");
+  map<string, double> Times;
+  LoadPatternTimes(TimesFile, Times);
+  std::stable_sort(ToSearch.begin(), ToSearch.end(),
+		   LongestFirst(Patterns, Times));
+
+  // Only searches run in parallel: a task per pattern, handed to idle
+  // threads by the OpenMP runtime.
 #ifdef PARALLEL_SEARCH
-#pragma omp parallel for shared(Cache, Log, SSfunc, SSheaders) schedule (dynamic, 1)
+#pragma omp parallel
+#pragma omp single
 #endif
-  for (unsigned i = 0; i < PatMan.size(); ++i) {
+  for (unsigned j = 0; j < ToSearch.size(); ++j) {
 #ifdef PARALLEL_SEARCH
-    int tid = omp_get_thread_num() + 1;
+#pragma omp task default(shared) firstprivate(j)
 #endif
-    PatternManager::Iterator I = PatMan.getElementAt(i);
-    bool CacheHit = false;
-    SearchResult *SR;
+    {
+      const unsigned i = ToSearch[j];
+      const double Start = WallTime();
+      Results[i] = FindImplementation(Patterns[i]->TargetImpl, *Logs[i], 0,
+				      SEARCH_DEPTH, &Statuses[i], &Stats[i]);
+      // Records of failed attempts are freed to the pools of this thread
+      TrimSearchPools();
+      const double Elapsed = WallTime() - Start;
 #ifdef PARALLEL_SEARCH
-#pragma omp critical
-{
-    Log << "Thread " << tid << ": ";
-#endif    
-    count ++;
-    Log << "Now finding implementation for : " << I->Name << "\n";  
-    SR = invalidCache? NULL : Cache.LoadRecord(I->Name);
-    if (SR != NULL) {
-      CacheHit = true;
-      Log << "Recovered from cache.\n";
-      SR->DumpResults(Log);
-    }
-#ifdef PARALLEL_SEARCH
-}
-    if (SR == NULL)
-      SR = FindImplementation(I->TargetImpl, Log, tid);
-#else
-    if (SR == NULL)
-      SR = FindImplementation(I->TargetImpl, Log);
-#endif
-    
-#ifdef PARALLEL_SEARCH
-#pragma omp critical
-{
+#pragma omp critical (PatternTimes)
 #endif
+      Times[Patterns[i]->Name] = Elapsed;
+    }
+  }
+  if (!ToSearch.empty() && !SavePatternTimes(TimesFile, Times))
+    Log << "Warning: could not save search times to " << TimesFile
+	<< ".\n";
+  const string StatsFile("searchstats.json");
+  if (!SaveSearchStats(StatsFile, Patterns, Results, CacheHits, Statuses,
+		       Stats))
+    Log << "Warning: could not save search statistics to " << StatsFile
+	<< ".\n";
+
+  // Results are handled in pattern order. Patterns with no implementation
+  // are left out of the backend, so that the remaining ones are still
+  // generated and all failures are reported in a single run.
+  bool MissingBuiltIn = false;
+  for (unsigned i = 0; i < NumPatterns; ++i) {
+    PatternManager::Iterator I = Patterns[i];
+    SearchResult *SR = Results[i];
+    Log << Logs[i]->str();
+    delete Logs[i];
     if (SR == NULL) {
       std::cerr << "Failed: Could not find implementation for pattern " <<
 	I->Name << "\n\n";
+      if (Statuses[i] == SearchOutOfBudget)
+	std::cerr << "The search budget ran out. A larger budget (see flags"
+	  " -s and -n) may be enough.\n";
       std::cerr << "The semantic DAG below represents the required pattern.\nDAG: ";
       I->TargetImpl->print(std::cerr);      
       std::cerr << "\n\nPlease check if your machine has enough instructions to perform"
       " these operations. Alternatively, you may update the RULES file to teach the "
       "system how to do it with your instructions.\n";
-      abort();
-    }    
-    if (!CacheHit)
+      Log << "Skipped pattern " << I->Name << ": "
+	  << getStatusName(Statuses[i]) << ".\n";
+      ++FailedPatterns;
+      if (isBuiltInPattern(I->Name))
+	MissingBuiltIn = true;
+      continue;
+    }
+    count ++;
+    if (!CacheHits[i])
       Cache.SaveRecord(SR, I->Name);
     SSfunc << PatTrans.genEmitSDNode(SR, I->LLVMDAG, count, &LMap) << endl;
     SSheaders << PatTrans.genEmitSDNodeHeader(count);
@@ -1714,18 +1940,26 @@ void TemplateManager::generateSimplePatterns(std::ostream &Log,
       InferenceResults.GlobalAddressSR = SR;
     else
       delete SR;
-#ifdef PARALLEL_SEARCH
-}
-#endif
   }    
   stringstream SSswitch;
   for (map<string, MatcherCode>::iterator I = Map.begin(), E = Map.end();
        I != E; ++I) {
     I->second.Print(SSswitch);;
   }
+  if (!Search::SaveTransCache(TransCacheFile, Version, PatternStrategy))
+    Log << "Warning: could not save dead ends to " << TransCacheFile
+	<< ".\n";
   end = std::time(0);
   Log << count << " pattern(s) implemented successfully in " << 
     std::difftime(end,start) << " second(s).\n";
+  if (FailedPatterns != 0)
+    Log << FailedPatterns << " pattern(s) skipped (see " << StatsFile
+	<< ").\n";
+  if (MissingBuiltIn) {
+    std::cerr << "Failed: A built-in pattern has no implementation, the "
+      "backend cannot be generated.\n";
+    exit(EXIT_FAILURE);
+  }
     
   assert(InferenceResults.StoreToStackSlotSR != NULL && 
 	 "Missing built-in pattern STOREFI");
@@ -85,6 +85,15 @@ class TemplateManager {
   } InferenceResults;
 
   bool ForceCacheUsage;
+  // Search budget of each pattern, in seconds and in expanded nodes. 0
+  // means no limit.
+  double SearchSeconds;
+  unsigned long long SearchNodes;
+  // Strategy of pattern searches (see Search::setStrategy). Best-first
+  // search, when built in, replaces the depth-first strategy.
+  SearchStrategy PatternStrategy;
+  // Patterns with no implementation, left out of the backend
+  unsigned FailedPatterns;
   
   std::string generateAddImm(const std::string& DestName,
 			       const std::string& BaseName,
@@ -131,7 +140,8 @@ class TemplateManager {
   std::string generateGlobalImmBeforePc();
   SearchResult* FindImplementation(const expression::Tree *Exp,
 				   std::ostream &Log, int TID, 
-				   unsigned MaxDepth);
+				   unsigned MaxDepth, SearchStatus *Status,
+				   SearchStats *Stats);
   std::string PostprocessLLVMDAGString(const std::string &S, SDNode *DAG);
   std::string generateReturnLowering();
   void generateSimplePatterns(std::ostream &Log, std::string **EmitFunctions,
@@ -150,7 +160,8 @@ class TemplateManager {
   NumRegs(0), IsBigEndian(true), WordSize(32), RuleManager(TR),
     InstructionManager(IM), RegisterClassManager(RM), OperandTable(OM),
     OperatorTable(ORM), PatMan(PM), PatTrans(OM), WorkingDir(NULL),
-    Version(Version), ForceCacheUsage(FCU) {
+    Version(Version), ForceCacheUsage(FCU), SearchSeconds(0),
+    SearchNodes(0), PatternStrategy(DepthFirstStrategy), FailedPatterns(0) {
       CommentChar = '#';
       TypeCharSpecifier = '@';
       InferenceResults.StoreToStackSlotSR = NULL;
@@ -195,6 +206,13 @@ class TemplateManager {
   void SetTemplateDir (const char * wdir) { TemplateDir = wdir; }
   void SetIsBigEndian (bool val) { IsBigEndian = val; }
   void SetWordSize(unsigned val) { WordSize = val; }
+  void SetSearchBudget(double Seconds, unsigned long long Nodes) {
+    SearchSeconds = Seconds;
+    SearchNodes = Nodes;
+  }
+  void SetSearchStrategy(SearchStrategy val) { PatternStrategy = val; }
+  // Number of patterns CreateBackendFiles could not implement
+  unsigned getFailedPatterns() const { return FailedPatterns; }
 
   void CreateBackendFiles();
 
@@ -71,6 +71,10 @@ struct StartupInfo {
   bool GenerateProfilingFlag;
   bool VerboseFlag;
   bool ChangeArchNameFlag;
+  // Search budget of each pattern (0 means no limit)
+  double SearchSeconds;
+  unsigned long long SearchNodes;
+  SearchStrategy PatternStrategy;
   StartupInfo() {
     ForceCacheFlag = false;
     VerboseFlag = false;
@@ -78,6 +82,9 @@ struct StartupInfo {
     GeneratePatternsFlag = false;
     GenerateProfilingFlag = false;
     ChangeArchNameFlag = false;
+    SearchSeconds = 0;
+    SearchNodes = 0;
+    PatternStrategy = DepthFirstStrategy;
   }
 };
 
@@ -451,7 +458,11 @@ void PrintUsage(string AppName, string Message) {
                "\t-t\tSelect generate patterns mode.\n"
                "\t-p\tGenerate assembly profile mode.\n"
                "\t-b\tGenerate compiler backend mode [default].\n"
-               "\t-c\tAvoid name clashes in LLVM build system by changing architecture name.\n\n";
+               "\t-c\tAvoid name clashes in LLVM build system by changing architecture name.\n"
+               "\t-s<n>\tSearch each pattern for at most n seconds.\n"
+               "\t-n<n>\tSearch each pattern expanding at most n nodes.\n"
+               "\t-e\tSearch patterns with the e-graph engine.\n"
+               "\t-m\tSearch patterns from both ends (meet in the middle).\n\n";
   std::cerr << "Example: " << AppName << " armv5e.ac\n\n";
 }
 
@@ -546,6 +557,28 @@ StartupInfo * ProcessArguments(int argc, char **argv) {
 	std::cout << "Change architecture name flag used.\n";
 	Result->ChangeArchNameFlag = true;
 	break;
+      // Search budgets. Searches that run out of budget are retried with
+      // a larger one before giving up.
+      case 's':
+	Result->SearchSeconds = atof(Param.substr(2).c_str());
+	std::cout << "Search budget of " << Result->SearchSeconds
+		  << " second(s) per pattern.\n";
+	break;
+      case 'n':
+	Result->SearchNodes = strtoull(Param.substr(2).c_str(), NULL, 10);
+	std::cout << "Search budget of " << Result->SearchNodes
+		  << " node(s) per pattern.\n";
+	break;
+      // Saturate patterns with equivalences before searching them
+      case 'e':
+	std::cout << "E-graph search flag used.\n";
+	Result->PatternStrategy = EGraphStrategy;
+	break;
+      // Also transform patterns into forms of instruction semantics
+      case 'm':
+	std::cout << "Bidirectional search flag used.\n";
+	Result->PatternStrategy = BidirectionalStrategy;
+	break;
     }    
   } while (num > 1);
   
@@ -753,7 +786,16 @@ int main(int argc, char **argv) {
     helper::CMemWatcher::Destroy();
     exit(EXIT_FAILURE);
   }    
+
+#ifdef COMPILED_RULES
+  // Rules changed since genrules was run are still interpreted
+  if (RuleManager.UseCompiledRules(CompiledRules, NumCompiledRules) !=
+      NumCompiledRules)
+    std::cerr << "Warning: transformation rules changed since genrules "
+	      << "was run. Please rebuild.\n";
+#endif
   
+  unsigned FailedPatterns = 0;
   if (SI->GenerateBackendFlag || SI->GeneratePatternsFlag) {
     const char *TmpDir = "llvmbackend";
     create_dir(TmpDir);
@@ -782,10 +824,17 @@ int main(int argc, char **argv) {
     TM.SetTemplateDir(SI->TemplateDir.c_str());
     TM.SetIsBigEndian(ac_tgt_endian == 1? true: false);
     TM.SetWordSize(wordsize);
+    TM.SetSearchBudget(SI->SearchSeconds, SI->SearchNodes);
+    TM.SetSearchStrategy(SI->PatternStrategy);
     TM.CreateBackendFiles();
+    FailedPatterns = TM.getFailedPatterns();
   }
   
-  if (SI->GenerateBackendFlag) {
+  // An incomplete backend is not patched into LLVM
+  if (SI->GenerateBackendFlag && FailedPatterns != 0)
+    std::cout << "Skipping LLVM source tree patch: " << FailedPatterns
+	      << " pattern(s) could not be implemented.\n";
+  else if (SI->GenerateBackendFlag) {
     const char *TmpDir = "llvmbackend";
     std::cout << "Patching LLVM source tree...\n";
     if (!PatchLLVM(SI, TmpDir)) {
@@ -811,5 +860,5 @@ int main(int argc, char **argv) {
   helper::CMemWatcher::Destroy();
   //  DeallocateACParser();
   
-  return 0;
+  return FailedPatterns != 0? EXIT_FAILURE : 0;
 }
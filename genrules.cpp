@@ -0,0 +1,234 @@
+//===- genrules.cpp - Transformation rules compiler        --*- C++ -*-----===//
+//
+//              The ArchC Project - Compiler Backend Generation
+//
+//===----------------------------------------------------------------------===//
+//
+// Reads the transformation rules file and writes C++ code with a matcher
+// and a rewriter for each rule and direction, specialized to its
+// patterns. Linked into genllvmbe (see "COMPILED_RULES=1 make"), this code
+// replaces the generic interpretation of rules by MatchExpByRule.
+//
+//===----------------------------------------------------------------------===//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <cstdio>
+
+#include "InsnSelector/TransformationRules.h"
+#include "InsnSelector/Semantic.h"
+
+// Some parser dependent data and code
+extern FILE* yybein;
+extern int yybeparse();
+extern bool HasError;
+
+// Defined in semantics parser
+extern backendgen::TransformationRules RuleManager;
+
+using namespace backendgen;
+using namespace backendgen::expression;
+using std::string;
+
+namespace {
+
+// Writes Text as a C++ string literal
+string Quote(const string& Text) {
+  string Result("\"");
+  for (string::const_iterator I = Text.begin(), E = Text.end(); I != E; ++I) {
+    if (*I == '"' || *I == '\\')
+      Result += '\\';
+    Result += *I;
+  }
+  return Result + "\"";
+}
+
+// Emits the checks MatchExpByRule performs when matching pattern node R
+// with the expression node held in variable E<Var>, then does the same
+// for the children of R. Bindings receives the statements adding the
+// operands of R to the list of bindings.
+void EmitMatch(const Tree* R, unsigned Var, unsigned& NumVars,
+	       std::ostream& O, std::ostream& Bindings) {
+  const unsigned Type = R->getType(), Size = R->getSize();
+  std::stringstream E;
+  E << "E" << Var;
+  const string Exp = E.str();
+  if (R->isOperator()) {
+    const Operator* RO = static_cast<const Operator*>(R);
+    O << "    if (!" << Exp << "->isOperator())\n"
+      << "      return false;\n";
+    // Same type and size, unless the rule operator is a wildcard
+    std::stringstream SameType;
+    SameType << Exp << "->getType() == " << Type << "U";
+    if (Size != 0)
+      SameType << " && (" << Exp << "->getSize() == " << Size << "U || "
+	       << Exp << "->getSize() == 0)";
+    if (Type != 0)
+      O << "    if (!(" << SameType.str() << "))\n";
+    else
+      O << "    if (!((" << SameType.str() << ") ||\n"
+	<< "          (" << Exp << "->getType() != MemRefOp &&\n"
+	<< "           !" << Exp << "->isTransferDestination())))\n";
+    O << "      return false;\n";
+    for (int I = 0, N = RO->getArity(); I != N; ++I) {
+      const unsigned Child = NumVars++;
+      O << "    const Tree* E" << Child << " = (*static_cast<const Operator*>("
+	<< Exp << "))[" << I << "];\n";
+      EmitMatch((*RO)[I], Child, NumVars, O, Bindings);
+    }
+    return;
+  }
+  const Operand* Op = static_cast<const Operand*>(R);
+  Bindings << "      List->push_back(AnnotatedTree("
+	   << Quote(Op->getOperandName()) << ", " << Exp << "));\n";
+  // An operand may match an operator yielding a value of its type
+  O << "    if (" << Exp << "->isOperator()) {\n";
+  if (Type != 0) {
+    O << "      const Operator* O" << Var << " = static_cast<const Operator*>("
+      << Exp << ");\n"
+      << "      if (O" << Var << "->getReturnTypeType() != " << Type << "U";
+    if (Size != 0)
+      O << " ||\n"
+	<< "          O" << Var << "->getReturnTypeSize() != " << Size << "U";
+    O << ")\n";
+  } else {
+    O << "      if (!((static_cast<const Operator*>(" << Exp
+      << ")->getReturnTypeType() == 0";
+    if (Size != 0)
+      O << " &&\n"
+	<< "             static_cast<const Operator*>(" << Exp
+	<< ")->getReturnTypeSize() == " << Size << "U";
+    O << ") ||\n"
+      << "            (" << Exp << "->getType() != MemRefOp &&\n"
+      << "             !" << Exp << "->isTransferDestination())))\n";
+  }
+  O << "        return false;\n"
+    << "    } else {\n";
+  std::stringstream SameType;
+  SameType << Exp << "->getType() == " << Type << "U";
+  if (Size != 0)
+    SameType << " && (" << Exp << "->getSize() == " << Size << "U || "
+	     << Exp << "->getSize() == 0)";
+  if (Type != 0)
+    O << "      if (!(" << SameType.str() << "))\n";
+  else
+    O << "      if (!(" << SameType.str() << ") &&\n"
+      << "          " << Exp << "->isTransferDestination())\n";
+  O << "        return false;\n";
+  // Unless a wildcard, kinds must agree and constants be equal
+  if (Type != 0) {
+    if (R->getKind() == ConstantNode)
+      O << "      if (" << Exp << "->getKind() != ConstantNode ||\n"
+	<< "          static_cast<const Constant*>(" << Exp
+	<< ")->getConstValue() != "
+	<< static_cast<const Constant*>(R)->getConstValue() << "U)\n";
+    else if (R->getKind() == ImmediateNode)
+      O << "      if (" << Exp << "->getKind() != ImmediateNode)\n";
+    else
+      O << "      if (" << Exp << "->getKind() == ImmediateNode)\n";
+    O << "        return false;\n";
+  }
+  O << "    }\n";
+}
+
+// Emits the matcher and the rewriter of Rule in one direction: Patt1 is
+// matched and transformed in Patt2
+void EmitDirection(const Rule& R, const Tree* Patt1, const char* Direction,
+		   const char* Patt2Name, std::ostream& O) {
+  std::stringstream Body, Bindings;
+  unsigned NumVars = 1;
+  EmitMatch(Patt1, 0, NumVars, Body, Bindings);
+  O << "  bool Match" << R.RuleID << Direction
+    << "(const Tree* E0, AnnotatedTreeList* List) {\n"
+    << Body.str()
+    << "    if (List != NULL) {\n"
+    << Bindings.str()
+    << "      List->sort();\n"
+    << "    }\n"
+    << "    return true;\n"
+    << "  }\n\n"
+    << "  Tree* Apply" << R.RuleID << Direction
+    << "(const Tree* E0, const Rule& R) {\n"
+    << "    AnnotatedTreeList List;\n"
+    << "    if (!Match" << R.RuleID << Direction << "(E0, &List))\n"
+    << "      return NULL;\n"
+    << "    return InstantiatePattern(R." << Patt2Name
+    << ", &List, R.OpTransList);\n"
+    << "  }\n\n";
+}
+
+void EmitRules(const string& RulesFileName, std::ostream& O) {
+  O << "// Generated by genrules from " << RulesFileName << ". Do not edit.\n"
+    << "\n"
+    << "#include \"InsnSelector/TransformationRules.h\"\n"
+    << "#include \"InsnSelector/Semantic.h\"\n"
+    << "\n"
+    << "namespace backendgen {\n"
+    << "\n"
+    << "  using namespace backendgen::expression;\n"
+    << "\n"
+    << "namespace {\n\n";
+  unsigned NumRules = 0;
+  for (RuleIterator I = RuleManager.getBegin(), E = RuleManager.getEnd();
+       I != E; ++I, ++NumRules) {
+    O << "  // Rule " << I->RuleID << ": ";
+    I->Print(O);
+    O << "\n";
+    EmitDirection(*I, I->LHS, "F", "RHS", O);
+    if (I->Equivalence)
+      EmitDirection(*I, I->RHS, "B", "LHS", O);
+  }
+  O << "}\n\n"
+    << "  const CompiledRule CompiledRules[] = {\n";
+  for (RuleIterator I = RuleManager.getBegin(), E = RuleManager.getEnd();
+       I != E; ++I) {
+    O << "    {" << Quote(I->getSignature()) << ",\n"
+      << "     Match" << I->RuleID << "F, ";
+    if (I->Equivalence)
+      O << "Match" << I->RuleID << "B, ";
+    else
+      O << "NULL, ";
+    O << "Apply" << I->RuleID << "F, ";
+    if (I->Equivalence)
+      O << "Apply" << I->RuleID << "B},\n";
+    else
+      O << "NULL},\n";
+  }
+  // Arrays may not be empty
+  if (NumRules == 0)
+    O << "    {\"\", NULL, NULL, NULL, NULL}\n";
+  O << "  };\n"
+    << "  const unsigned NumCompiledRules = " << NumRules << ";\n"
+    << "\n"
+    << "}\n";
+}
+
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <rules file> <output file>\n";
+    return EXIT_FAILURE;
+  }
+  FILE *rfp = std::fopen(argv[1], "r");
+  if (rfp == NULL) {
+    std::cerr << "Could not open rule information file \"" << argv[1]
+	      << "\".\n";
+    return EXIT_FAILURE;
+  }
+  yybein = rfp;
+  yybeparse();
+  std::fclose(rfp);
+  if (HasError)
+    return EXIT_FAILURE;
+
+  std::ofstream O(argv[2], std::ios::out | std::ios::trunc);
+  if (!O) {
+    std::cerr << "Could not open output file \"" << argv[2] << "\".\n";
+    return EXIT_FAILURE;
+  }
+  EmitRules(argv[1], O);
+  return O.good()? EXIT_SUCCESS : EXIT_FAILURE;
+}